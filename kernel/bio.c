@@ -1,9 +1,17 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
+// Each hash bucket has its own lock, so lookups of different
+// blocks on different harts do not contend.
+//
+// Besides NBUF buffers of its own, the cache grows a page of
+// block data at a time from kalloc(), up to 1/BCACHEFRAC of
+// memory, and gives unused pages back when kalloc() runs out.
+// The buf headers live apart, in bcache, so that a page holds
+// exactly PGSIZE/BSIZE blocks.
 //
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
@@ -16,6 +24,7 @@
 
 #include "types.h"
 #include "param.h"
+#include "memlayout.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "riscv.h"
@@ -23,14 +32,44 @@
 #include "fs.h"
 #include "buf.h"
 
+#define NBUCKET 1031
+#define BHASH(dev, blockno) (((dev) * 31 + (blockno)) % NBUCKET)
+
+// most pages the cache may grow to.
+#define BCACHEPAGES ((PHYSTOP - KERNBASE) / PGSIZE / BCACHEFRAC)
+
+// blocks in a kalloc()ed page.
+#define BPERPAGE (PGSIZE / BSIZE)
+
 struct {
+  // serializes evictions, the only time a buffer moves
+  // between buckets and so the only time two bucket
+  // locks are held at once; also protects free, nbuf,
+  // the data pointers of all but the first NBUF buffers,
+  // npage, hand and the counters but hits.
   struct spinlock lock;
-  struct buf buf[NBUF];
+  // the first NBUF always have their data in data[], so
+  // bget() cannot fail; then a group of BPERPAGE for each
+  // page the cache may grow by, with data 0 when it has not.
+  struct buf buf[NBUF + BCACHEPAGES*BPERPAGE];
+  uchar data[NBUF][BSIZE] __attribute__((aligned(8))); // for balloc()'s word scan
+  int nbuf;               // buf[nbuf] onwards have never had a page
+  struct buf *free;       // never-used buffers, through next
+  int npage;
+  int hand;               // where bevict() looks next
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+  uint hits;              // bget()s that found the block cached
+  uint misses;
+  uint evictions;         // misses that recycled a cached block
+  uint aheads;            // blocks read ahead
+  uint shrinks;           // pages given back to kalloc()
+
+  // Hash table of cached blocks, by (dev, blockno), each
+  // bucket a list through next with its own lock.
+  struct {
+    struct spinlock lock;
+    struct buf *head;
+  } bucket[NBUCKET];
 } bcache;
 
 void
@@ -39,53 +78,273 @@ binit(void)
   struct buf *b;
 
   initlock(&bcache.lock, "bcache");
+  for(int i = 0; i < NBUCKET; i++)
+    initlock(&bcache.bucket[i].lock, "bcache.bucket");
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+  for(b = bcache.buf; b < bcache.buf+NELEM(bcache.buf); b++)
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  for(int i = 0; i < NBUF; i++){
+    b = &bcache.buf[i];
+    b->data = bcache.data[i];
+    b->next = bcache.free;
+    bcache.free = b;
   }
+  bcache.nbuf = NBUF;
 }
 
-// Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
-static struct buf*
-bget(uint dev, uint blockno)
+// Give the blocks of page pa to a group of buffers that has
+// none and add them to the free list; or, if another process
+// has meanwhile grown the cache to its limit, give pa back.
+// bcache.lock must be held.
+static void
+bgrow(char *pa)
 {
   struct buf *b;
+  int i;
 
-  acquire(&bcache.lock);
+  if(bcache.npage >= BCACHEPAGES){
+    kfree(pa);
+    return;
+  }
+  for(b = bcache.buf+NBUF; b->data; b += BPERPAGE)
+    ;
+  for(i = 0; i < BPERPAGE; i++){
+    b[i].data = (uchar*)pa + i*BSIZE;
+    b[i].next = bcache.free;
+    bcache.free = &b[i];
+  }
+  if(b+BPERPAGE > bcache.buf+bcache.nbuf)
+    bcache.nbuf = b+BPERPAGE - bcache.buf;
+  bcache.npage++;
+}
 
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+// Return the buffer for dev, blockno in bucket h, with a
+// reference taken, or 0. bucket[h].lock must be held.
+static struct buf*
+bfind(int h, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bcache.bucket[h].head; b; b = b->next){
     if(b->dev == dev && b->blockno == blockno){
       b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
       return b;
     }
   }
+  return 0;
+}
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+// Unlink b from bucket h, or from the free list if it is
+// not hashed. Caller holds bcache.lock and, if b is hashed,
+// bucket[h].lock.
+static void
+bunlink(struct buf *b, int h)
+{
+  struct buf **pp;
+
+  pp = b->hashed ? &bcache.bucket[h].head : &bcache.free;
+  while(*pp != b)
+    pp = &(*pp)->next;
+  *pp = b->next;
+  b->hashed = 0;
+}
+
+// Unlink and return an unused cached buffer that has not
+// been released since the clock hand last passed it, taking
+// the used mark off those that have on the way; or 0 if
+// every buffer is in use. An approximate LRU that locks
+// only the victim's bucket. Caller holds bcache.lock, so no
+// buffer changes buckets meanwhile, and bucket[h].lock.
+static struct buf*
+bevict(int h)
+{
+  struct buf *b;
+  int i, n, bh;
+
+  // twice round: once to take the marks off, once to find one.
+  n = 2 * bcache.nbuf;
+  for(i = 0; i < n; i++){
+    b = &bcache.buf[bcache.hand];
+    bcache.hand = (bcache.hand + 1) % bcache.nbuf;
+    // a peek without b's bucket lock; checked again below.
+    if(!b->hashed || b->refcnt != 0)
+      continue;
+    if(b->used){
+      b->used = 0;
+      continue;
     }
+    bh = BHASH(b->dev, b->blockno);
+    if(bh != h)
+      acquire(&bcache.bucket[bh].lock);
+    if(b->refcnt == 0)
+      bunlink(b, bh);
+    if(bh != h)
+      release(&bcache.bucket[bh].lock);
+    if(!b->hashed)
+      return b;
   }
-  panic("bget: no buffers");
+  return 0;
+}
+
+// Look through buffer cache for block on device dev.
+// If not found, allocate a buffer.
+// In either case, return locked buffer.
+// If ahead is set, the caller only wants to read the block
+// ahead of time, so return 0 instead if it is cached or
+// every buffer is in use.
+static struct buf*
+bget(uint dev, uint blockno, int ahead)
+{
+  struct buf *b;
+  char *pa;
+  int h;
+
+  h = BHASH(dev, blockno);
+  acquire(&bcache.bucket[h].lock);
+
+  // Is the block already cached?
+  b = bfind(h, dev, blockno);
+  if(b && ahead)
+    b->refcnt--;
+  release(&bcache.bucket[h].lock);
+  if(b){
+    if(ahead)
+      return 0;
+    __sync_fetch_and_add(&bcache.hits, 1);
+    acquiresleep(&b->lock);
+    return b;
+  }
+
+  // Not cached. Grow the cache if it is allowed to,
+  // taking the page before any cache lock, since
+  // kalloc() may call bshrink().
+  pa = 0;
+  if(bcache.free == 0 && bcache.npage < BCACHEPAGES)
+    pa = kalloc();
+
+  // Look again with the eviction lock held, in case
+  // another process cached it meanwhile.
+  acquire(&bcache.lock);
+  if(pa)
+    bgrow(pa);
+  acquire(&bcache.bucket[h].lock);
+  b = bfind(h, dev, blockno);
+  if(b){
+    if(ahead)
+      b->refcnt--;
+    release(&bcache.bucket[h].lock);
+    release(&bcache.lock);
+    if(ahead)
+      return 0;
+    __sync_fetch_and_add(&bcache.hits, 1);
+    acquiresleep(&b->lock);
+    return b;
+  }
+
+  if((b = bcache.free) != 0){
+    bcache.free = b->next;
+  } else if((b = bevict(h)) != 0){
+    bcache.evictions++;
+  } else if(ahead){
+    release(&bcache.bucket[h].lock);
+    release(&bcache.lock);
+    return 0;
+  } else {
+    panic("bget: no buffers");
+  }
+  if(ahead)
+    bcache.aheads++;
+  else
+    bcache.misses++;
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  b->hashed = 1;
+  b->next = bcache.bucket[h].head;
+  bcache.bucket[h].head = b;
+  release(&bcache.bucket[h].lock);
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
+}
+
+// If no buffer in the group of BPERPAGE at pb is in use,
+// unlink them all and return 1. bcache.lock must be held.
+static int
+bpagefree(struct buf *pb)
+{
+  int h[BPERPAGE], locked[BPERPAGE];
+  int i, j, busy;
+
+  // lock each bucket involved once.
+  for(i = 0; i < BPERPAGE; i++){
+    h[i] = BHASH(pb[i].dev, pb[i].blockno);
+    locked[i] = pb[i].hashed;
+    for(j = 0; j < i && locked[i]; j++)
+      if(locked[j] && h[j] == h[i])
+        locked[i] = 0;
+    if(locked[i])
+      acquire(&bcache.bucket[h[i]].lock);
+  }
+
+  busy = 0;
+  for(i = 0; i < BPERPAGE; i++)
+    if(pb[i].refcnt != 0)
+      busy = 1;
+  for(i = 0; i < BPERPAGE && !busy; i++)
+    bunlink(&pb[i], h[i]);
+
+  for(i = 0; i < BPERPAGE; i++)
+    if(locked[i])
+      release(&bcache.bucket[h[i]].lock);
+  return !busy;
+}
+
+// Give up to n pages of unused buffers back to the page
+// allocator; kalloc() calls this when memory runs out.
+// Returns the number of pages freed.
+int
+bshrink(int n)
+{
+  struct buf *pb;
+  char *pa, *freed;
+  int i, nfreed;
+
+  freed = 0;
+  nfreed = 0;
+  acquire(&bcache.lock);
+  for(pb = bcache.buf+NBUF; nfreed < n && pb < bcache.buf+bcache.nbuf; pb += BPERPAGE){
+    if(pb->data == 0 || !bpagefree(pb))
+      continue;
+    pa = (char*)pb->data;
+    for(i = 0; i < BPERPAGE; i++)
+      pb[i].data = 0;
+    // chain the pages through their first word.
+    *(char**)pa = freed;
+    freed = pa;
+    bcache.npage--;
+    bcache.shrinks++;
+    nfreed++;
+  }
+  release(&bcache.lock);
+
+  for(; freed; freed = pa){
+    pa = *(char**)freed;
+    kfree(freed);
+  }
+  return nfreed;
+}
+
+// Print buffer cache statistics. For debugging.
+// Runs when user types ^P on console.
+// No lock to avoid wedging a stuck machine further.
+void
+bcachedump(void)
+{
+  printf("bcache: %d pages (max %d), hit %d miss %d ahead %d evict %d shrink %d\n",
+         bcache.npage, (int)BCACHEPAGES, bcache.hits, bcache.misses,
+         bcache.aheads, bcache.evictions, bcache.shrinks);
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -94,7 +353,7 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
   if(!b->valid) {
     virtio_disk_rw(b, 0);
     b->valid = 1;
@@ -102,6 +361,58 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Return a locked buf for a block whose old contents do not
+// matter, such as a newly allocated one, holding zeros rather
+// than what a read from disk would have found.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno, 0);
+  memset(b->data, 0, BSIZE);
+  b->valid = 1;
+  return b;
+}
+
+// Start reading the indicated block into the cache, unless
+// it is there already, and return without waiting for it.
+// A later bread() of the block waits for the read to finish.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno, 1);
+  if(b == 0)
+    return;
+  if(b->valid){
+    // someone read it in between.
+    brelse(b);
+    return;
+  }
+  virtio_disk_read_async(b);
+}
+
+// Called by the disk driver, from the disk interrupt, when a
+// read started by breadahead() has finished. Does the same
+// as brelse(), for the process that started the read.
+void
+bdone(struct buf *b)
+{
+  int h;
+
+  b->valid = 1;
+  releasesleep(&b->lock);
+
+  h = BHASH(b->dev, b->blockno);
+  acquire(&bcache.bucket[h].lock);
+  b->refcnt--;
+  if (b->refcnt == 0)
+    b->used = 1;
+  release(&bcache.bucket[h].lock);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,43 +422,63 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Start writing b's contents to disk, and return without
+// waiting, so that many writes can be in flight at once.
+// b must be locked, and stay locked until bwait(b).
+void
+bwritestart(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwritestart");
+  virtio_disk_start(b, 1);
+}
+
+// Wait for the write bwritestart() started on b to finish.
+void
+bwait(struct buf *b)
+{
+  virtio_disk_wait(b);
+}
+
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// Mark it used, so that bevict() passes it over once.
 void
 brelse(struct buf *b)
 {
+  int h;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  // b cannot change buckets while we hold a reference.
+  h = BHASH(b->dev, b->blockno);
+  acquire(&bcache.bucket[h].lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->used = 1;
   }
-  
-  release(&bcache.lock);
+  release(&bcache.bucket[h].lock);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  int h = BHASH(b->dev, b->blockno);
+
+  acquire(&bcache.bucket[h].lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bcache.bucket[h].lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  int h = BHASH(b->dev, b->blockno);
+
+  acquire(&bcache.bucket[h].lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bcache.bucket[h].lock);
 }
 
 
@@ -5,8 +5,12 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
-  uchar data[BSIZE];
+  int used;         // released since the clock hand last passed
+  int hashed;       // in a hash bucket, rather than free
+  struct buf *next; // next in hash bucket
+  struct buf *qnext; // next in disk queue, or in one disk request
+  char qwrite;      // queued to write, else to read
+  char qasync;      // no one waits; disk calls bdone() when done
+  uchar *data;      // BSIZE bytes, in bcache or in a page it grew by
 };
 
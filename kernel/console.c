@@ -83,7 +83,13 @@ consoleread(int user_dst, uint64 dst, int n)
   int c;
   char cbuf;
 
+  // either_copyout() below runs with cons.lock held.
+  // a read returns at most a bufferful.
+  if(n > INPUT_BUF_SIZE)
+    n = INPUT_BUF_SIZE;
   target = n;
+  if(user_dst)
+    uvmprefault(myproc()->pagetable, dst, n, PTE_W);
   acquire(&cons.lock);
   while(n > 0){
     // wait until interrupt handler has put some
@@ -138,8 +144,10 @@ consoleintr(int c)
   acquire(&cons.lock);
 
   switch(c){
-  case C('P'):  // Print process list.
+  case C('P'):  // Print process list and memory statistics.
     procdump();
+    kmemdump();
+    bcachedump();
     break;
   case C('U'):  // Kill line.
     while(cons.e != cons.w &&
@@ -8,14 +8,22 @@ struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct segment;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bnew(uint, uint);
 void            brelse(struct buf*);
+void            breadahead(uint, uint);
+void            bdone(struct buf*);
 void            bwrite(struct buf*);
+void            bwritestart(struct buf*);
+void            bwait(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+int             bshrink(int);
+void            bcachedump(void);
 
 // console.c
 void            consoleinit(void);
@@ -24,6 +32,8 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+struct segment* segfind(struct proc*, uint64);
+int             segload(struct proc*, struct segment*, uint64, char*);
 
 // file.c
 struct file*    filealloc(void);
@@ -53,6 +63,7 @@ int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
+void            iflushall(void);
 
 // ramdisk.c
 void            ramdiskinit(void);
@@ -63,12 +74,17 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void            kmemdump(void);
+void            krefinc(void *);
+int             krefcnt(void *);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            log_reserve(int);
+void            log_unreserve(int);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
@@ -100,6 +116,7 @@ void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+struct proc*    kthread(void (*)(void), char*);
 int             wait(uint64);
 void            wakeup(void*);
 void            yield(void);
@@ -108,7 +125,21 @@ int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
 void            set_priority(int priority, int pid, int* old);
 int             waitx(uint64 addr,int* rtime, int* wtime);
-void            update_time(void);
+int             account(struct proc*);
+
+// sched.c
+extern int      schedpolicy;
+void            sched_init(void);
+void            setrunnable(struct proc*);
+struct proc*    sched_next(struct cpu*);
+void            sched_idle(struct cpu*);
+int             sched_tick(struct proc*);
+int             sched_ipi(void);
+int             setsched(int, int);
+void            sched_settickets(struct proc*, int);
+void            sched_reprioritize(struct proc*);
+char*           schedname(int);
+int             nice_priority(struct proc*);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -148,8 +179,16 @@ void            syscall();
 extern uint     ticks;
 void            trapinit(void);
 void            trapinithart(void);
-extern struct spinlock tickslock;
 void            usertrapret(void);
+void            clockintr(void);
+void            sendipi(int);
+
+// timer.c
+void            timerwheelinit(void);
+int             timerintr(void);
+void            timeridle(int);
+int             timersleep(uint64);
+void            timerwake(struct proc*);
 
 // uart.c
 void            uartinit(void);
@@ -168,6 +207,9 @@ void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcow(pagetable_t, uint64);
+int             vmfault(pagetable_t, uint64, int);
+void            uvmprefault(pagetable_t, uint64, uint64, int);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
@@ -186,6 +228,9 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_start(struct buf *, int);
+void            virtio_disk_wait(struct buf *);
+void            virtio_disk_read_async(struct buf *);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
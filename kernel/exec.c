@@ -3,12 +3,13 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
 
-static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
-
 int flags2perm(int flags)
 {
     int perm = 0;
@@ -19,15 +20,21 @@ int flags2perm(int flags)
     return perm;
 }
 
+// Replace the current process's image with the program
+// at path. Loadable segments are not read here: exec()
+// only records where they live in the file, keeps a
+// reference to the inode, and lets vmfault() page them
+// in on first use.
 int
 exec(char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
+  int i, off, nseg = 0;
   uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *exe = 0, *oldexe;
   struct proghdr ph;
+  struct segment seg[NSEG];
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
@@ -49,7 +56,7 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Record the program's segments.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -61,15 +68,24 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
+    if(ph.vaddr < sz || ph.vaddr + ph.memsz >= TRAPFRAME)
+      goto bad;
+    if(ph.off + ph.filesz < ph.off || ph.off + ph.filesz > ip->size)
       goto bad;
-    sz = sz1;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(nseg == NSEG)
       goto bad;
+    seg[nseg].va = ph.vaddr;
+    seg[nseg].memsz = ph.memsz;
+    seg[nseg].off = ph.off;
+    seg[nseg].filesz = ph.filesz;
+    seg[nseg].perm = flags2perm(ph.flags);
+    nseg++;
+    sz = ph.vaddr + ph.memsz;
   }
-  iunlockput(ip);
+  // keep the reference to ip for paging in.
+  iunlock(ip);
   end_op();
+  exe = ip;
   ip = 0;
 
   p = myproc();
@@ -122,11 +138,20 @@ exec(char *path, char **argv)
     
   // Commit to the user image.
   oldpagetable = p->pagetable;
+  oldexe = p->exe;
   p->pagetable = pagetable;
   p->sz = sz;
+  p->exe = exe;
+  p->nseg = nseg;
+  memmove(p->seg, seg, sizeof(seg));
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
   proc_freepagetable(oldpagetable, oldsz);
+  if(oldexe){
+    begin_op();
+    iput(oldexe);
+    end_op();
+  }
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
@@ -137,30 +162,53 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(exe){
+    begin_op();
+    iput(exe);
+    end_op();
+  }
   return -1;
 }
 
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
+// Return the segment of p's executable that
+// contains va, or 0 if there is none.
+struct segment*
+segfind(struct proc *p, uint64 va)
 {
-  uint i, n;
-  uint64 pa;
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
+  struct segment *s;
+
+  for(s = p->seg; s < &p->seg[p->nseg]; s++){
+    if(va >= s->va && va < s->va + s->memsz)
+      return s;
   }
-  
   return 0;
 }
+
+// Fill the zeroed page mem, about to be mapped at
+// page-aligned va, with the part of segment s that
+// the executable's file backs.
+// Locks the executable's inode, so a copy to or from
+// user memory with any inode locked must not fault
+// here: fileread() and filewrite() fault the user
+// range in with uvmprefault() before locking.
+// Returns 0 on success, -1 on failure.
+int
+segload(struct proc *p, struct segment *s, uint64 va, char *mem)
+{
+  uint64 start, end;
+  int n;
+
+  start = va > s->va ? va : s->va;
+  end = va + PGSIZE;
+  if(end > s->va + s->filesz)
+    end = s->va + s->filesz;
+  if(start >= end)
+    return 0;  // all bss.
+
+  ilock(p->exe);
+  n = readi(p->exe, 0, (uint64)mem + (start - va),
+            s->off + (start - s->va), end - start);
+  iunlock(p->exe);
+
+  return n == end - start ? 0 : -1;
+}
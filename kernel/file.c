@@ -118,10 +118,30 @@ fileread(struct file *f, uint64 addr, int n)
       return -1;
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
+    // read a few pages at a time, faulting them in before
+    // locking the inode: paging in the executable locks
+    // its inode, and two processes could each hold the
+    // inode the other needs.
+    int max = 8*PGSIZE;
+    int i = 0;
+    while(i < n){
+      int n1 = n - i;
+      if(n1 > max)
+        n1 = max;
+
+      uvmprefault(myproc()->pagetable, addr + i, n1, PTE_W);
+      ilock(f->ip);
+      if((r = readi(f->ip, 1, addr + i, f->off, n1)) > 0)
+        f->off += r;
+      iunlock(f->ip);
+
+      if(r < 0)
+        return i ? i : -1;
+      i += r;
+      if(r != n1)
+        break;  // end of file or error
+    }
+    r = i;
   } else {
     panic("fileread");
   }
@@ -159,6 +179,8 @@ filewrite(struct file *f, uint64 addr, int n)
       if(n1 > max)
         n1 = max;
 
+      // fault the source in first; see fileread().
+      uvmprefault(myproc()->pagetable, addr + i, n1, PTE_R);
       begin_op();
       ilock(f->ip);
       if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
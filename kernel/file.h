@@ -27,6 +27,18 @@ struct inode {
   short nlink;
   uint size;
   uint addrs[NDIRECT+1];
+
+  // read-ahead; see readahead() in fs.c.
+  uint ranext;        // block a sequential reader reads next
+  uint rawin;         // blocks to read ahead of it
+  uint raend;         // blocks before this have been read ahead
+
+  uint goal;          // where bmap() looks for the next block; see balloc()
+
+  // delayed allocation; see idelay() in fs.c.
+  uint dfirst;        // first block with no disk block yet
+  uint ndelay;        // blocks from dfirst on that wait for one
+  uint dpromise;      // free disk blocks set aside for them
 };
 
 // map major device number to device functions.
@@ -22,6 +22,7 @@
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
@@ -37,6 +38,8 @@ readsb(int dev, struct superblock *sb)
   brelse(bp);
 }
 
+static void bcount(int);
+
 // Init fs
 void
 fsinit(int dev) {
@@ -44,6 +47,7 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  bcount(dev);
 }
 
 // Zero a block.
@@ -52,7 +56,7 @@ bzero(int dev, int bno)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
+  bp = bnew(dev, bno);
   memset(bp->data, 0, BSIZE);
   log_write(bp);
   brelse(bp);
@@ -60,33 +64,132 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
-// returns 0 if out of disk space.
-static uint
-balloc(uint dev)
+// The state of the free block bitmap. cursor is a hint for
+// balloc(): no block below it was free when it was last
+// moved, and bfree() moves it back down. nfree counts the
+// free blocks, promised of them set aside for delayed blocks.
+struct {
+  struct spinlock lock;
+  uint cursor;
+  uint nfree;
+  uint promised;
+} bitmap;
+
+// Count the free blocks, once the log has been recovered.
+static void
+bcount(int dev)
 {
-  int b, bi, m;
   struct buf *bp;
+  uint b, bi, n;
 
-  bp = 0;
+  n = 0;
   for(b = 0; b < sb.size; b += BPB){
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+    for(bi = 0; bi < BPB && b + bi < sb.size; bi++)
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        n++;
+    brelse(bp);
+  }
+  bitmap.nfree = n;
+}
+
+// Set aside n free blocks for delayed blocks, or return -1
+// if there are not that many.
+static int
+bpromise(uint n)
+{
+  int r = -1;
+
+  acquire(&bitmap.lock);
+  if(bitmap.nfree - bitmap.promised >= n){
+    bitmap.promised += n;
+    r = 0;
+  }
+  release(&bitmap.lock);
+  return r;
+}
+
+static void
+bunpromise(uint n)
+{
+  acquire(&bitmap.lock);
+  bitmap.promised -= n;
+  release(&bitmap.lock);
+}
+
+// Find a free block in [from, to), mark it in use and return
+// it, or return 0 if there is none. Looks at the bitmap 64
+// bits at a time, skipping the words that are full.
+static uint
+bscan(uint dev, uint from, uint to)
+{
+  struct buf *bp;
+  uint64 *w, m;
+  uint b, wi, bi;
+
+  for(b = from - from % BPB; b < to; b += BPB){
+    bp = bread(dev, BBLOCK(b, sb));
+    w = (uint64*)bp->data;
+    for(wi = b < from ? (from - b) / 64 : 0; wi < BPB/64 && b + wi*64 < to; wi++){
+      m = w[wi];
+      if(b + wi*64 < from)
+        m |= (1ULL << ((from - b) % 64)) - 1;  // not before from
+      if(m == ~0ULL)
+        continue;
+      for(bi = 0; m & (1ULL << bi); bi++)
+        ;
+      if(b + wi*64 + bi >= to)
+        break;
+      w[wi] |= 1ULL << bi;  // Mark block in use.
+      log_write(bp);
+      brelse(bp);
+      return b + wi*64 + bi;
     }
     brelse(bp);
   }
-  printf("balloc: out of blocks\n");
   return 0;
 }
 
+// Allocate a disk block, as near after goal as may be, or
+// from the cursor if goal is 0. Zeroed unless the caller
+// will fill it all. Takes one of the blocks *promise counts,
+// if any, as promised to the caller by bpromise().
+// returns 0 if out of disk space.
+static uint
+balloc(uint dev, uint goal, int zero, uint *promise)
+{
+  uint b, from, cursor;
+
+  acquire(&bitmap.lock);
+  if(*promise > 0){
+    (*promise)--;
+    bitmap.promised--;
+  } else if(bitmap.nfree <= bitmap.promised){
+    release(&bitmap.lock);
+    printf("balloc: out of blocks\n");
+    return 0;
+  }
+  bitmap.nfree--;
+  cursor = bitmap.cursor;
+  release(&bitmap.lock);
+  from = goal ? goal : cursor;
+  if(from >= sb.size)
+    from = 0;
+  // block 0 is the boot block, never free.
+  if((b = bscan(dev, from, sb.size)) == 0 && (b = bscan(dev, 0, from)) == 0)
+    panic("balloc: nfree");
+  if(goal == 0){
+    acquire(&bitmap.lock);
+    // unless bfree() or another balloc() moved it meanwhile.
+    if(bitmap.cursor == cursor)
+      bitmap.cursor = b + 1;
+    release(&bitmap.lock);
+  }
+  if(zero)
+    bzero(dev, b);
+  return b;
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
@@ -102,6 +205,11 @@ bfree(int dev, uint b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+  acquire(&bitmap.lock);
+  bitmap.nfree++;
+  if(b < bitmap.cursor)
+    bitmap.cursor = b;
+  release(&bitmap.lock);
 }
 
 // Inodes.
@@ -184,12 +292,14 @@ iinit()
   int i = 0;
   
   initlock(&itable.lock, "itable");
+  initlock(&bitmap.lock, "bitmap");
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&itable.inode[i].lock, "inode");
   }
 }
 
 static struct inode* iget(uint dev, uint inum);
+static void iflush(struct inode *ip);
 
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
@@ -271,6 +381,10 @@ iget(uint dev, uint inum)
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->ranext = 0;
+  ip->rawin = 0;
+  ip->raend = 0;
+  ip->goal = 0;
   release(&itable.lock);
 
   return ip;
@@ -330,7 +444,8 @@ iunlock(struct inode *ip)
 // If that was the last reference, the inode table entry can
 // be recycled.
 // If that was the last reference and the inode has no links
-// to it, free the inode (and its content) on disk.
+// to it, free the inode (and its content) on disk; if it has,
+// allocate its delayed blocks.
 // All calls to iput() must be inside a transaction in
 // case it has to free the inode.
 void
@@ -354,6 +469,14 @@ iput(struct inode *ip)
 
     releasesleep(&ip->lock);
 
+    acquire(&itable.lock);
+  } else if(ip->ref == 1 && ip->valid && ip->ndelay > 0){
+    // the table entry may be recycled, so the delayed
+    // blocks cannot wait for the commit.
+    acquiresleep(&ip->lock);
+    release(&itable.lock);
+    iflush(ip);
+    releasesleep(&ip->lock);
     acquire(&itable.lock);
   }
 
@@ -377,20 +500,31 @@ iunlockput(struct inode *ip)
 // listed in block ip->addrs[NDIRECT].
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bmap allocates one, next to the
+// last one it allocated for ip if it can. If fresh is
+// not 0, the new block is left as it was on disk, for the
+// caller to fill, and *fresh is set to 1.
 // returns 0 if out of disk space.
 static uint
-bmap(struct inode *ip, uint bn)
+bmap(struct inode *ip, uint bn, int *fresh)
 {
   uint addr, *a;
   struct buf *bp;
 
+  // ip may have been read back in since it last grew; the
+  // indirect case is below.
+  if(ip->goal == 0 && bn > 0 && bn <= NDIRECT && ip->addrs[bn-1])
+    ip->goal = ip->addrs[bn-1] + 1;
+
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = balloc(ip->dev, ip->goal, fresh == 0, &ip->dpromise);
       if(addr == 0)
         return 0;
       ip->addrs[bn] = addr;
+      ip->goal = addr + 1;
+      if(fresh)
+        *fresh = 1;
     }
     return addr;
   }
@@ -399,18 +533,24 @@ bmap(struct inode *ip, uint bn)
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
+      addr = balloc(ip->dev, ip->goal, 1, &ip->dpromise);
       if(addr == 0)
         return 0;
       ip->addrs[NDIRECT] = addr;
+      ip->goal = addr + 1;
     }
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
+    if(ip->goal == 0 && bn > 0 && a[bn-1])
+      ip->goal = a[bn-1] + 1;
     if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = balloc(ip->dev, ip->goal, fresh == 0, &ip->dpromise);
       if(addr){
         a[bn] = addr;
+        ip->goal = addr + 1;
         log_write(bp);
+        if(fresh)
+          *fresh = 1;
       }
     }
     brelse(bp);
@@ -420,6 +560,143 @@ bmap(struct inode *ip, uint bn)
   panic("bmap: out of range");
 }
 
+// Delayed allocation.
+//
+// writei() does not give a file's new blocks disk blocks
+// when it writes them. Their data waits in cache buffers,
+// pinned and keyed by DBLOCK(inum, bn) instead of a disk
+// block, and they are all allocated together, as a run,
+// just before the transaction commits, when logflush()
+// calls iflushall(); or sooner, if the inode leaves the
+// table first. A file has no holes, so the delayed blocks
+// are always its last ip->ndelay, from ip->dfirst on.
+//
+// So that allocating them cannot fail, writei() promises
+// each delayed block a free disk block, and reserves the
+// log space that allocating and logging it will take.
+
+// the cache key of delayed block bn of inode inum, beyond
+// any disk block.
+#define DBLOCK(inum, bn) (0x80000000 | ((inum) * MAXFILE + (bn)))
+
+// log blocks reserved for delayed blocks: for each, the
+// block and the bitmap block that records it; for each inode,
+// its indirect block and the bitmap block for that. The
+// inode's own block is in the transaction already, since
+// writei() logged the new size.
+#define DLOGBLK   2
+#define DLOGINODE 2
+
+// Is block bn of ip delayed?
+static int
+delayed(struct inode *ip, uint bn)
+{
+  return bn >= ip->dfirst && bn < ip->dfirst + ip->ndelay;
+}
+
+// Add a delayed block bn to the end of ip, holding the m
+// bytes at src from offset boff on, and zeros elsewhere.
+// Returns -1 if the disk is too full or the copy fails.
+// Caller must hold ip->lock, inside a transaction.
+static int
+idelay(struct inode *ip, uint bn, int user_src, uint64 src, uint boff, uint m)
+{
+  struct buf *bp;
+  uint need;
+
+  if(ip->ndelay > 0 && bn != ip->dfirst + ip->ndelay)
+    panic("idelay");
+
+  // the first may also need an indirect block.
+  need = ip->ndelay == 0 ? 2 : 1;
+  if(bpromise(need) < 0)
+    return -1;
+  bp = bnew(ip->dev, DBLOCK(ip->inum, bn));
+  if(either_copyin(bp->data + boff, user_src, src, m) == -1){
+    brelse(bp);
+    bunpromise(need);
+    return -1;
+  }
+  bpin(bp);
+  brelse(bp);
+
+  if(ip->ndelay == 0){
+    log_reserve(DLOGINODE);
+    ip->dfirst = bn;
+  }
+  log_reserve(DLOGBLK);
+  ip->ndelay++;
+  ip->dpromise += need;
+  return 0;
+}
+
+// Unpin ip's delayed blocks and give back what was set
+// aside for them.
+static void
+idrop(struct inode *ip)
+{
+  struct buf *bp;
+  uint bn;
+
+  if(ip->ndelay == 0)
+    return;
+  for(bn = ip->dfirst; bn < ip->dfirst + ip->ndelay; bn++){
+    bp = bread(ip->dev, DBLOCK(ip->inum, bn));  // pinned, so cached
+    bunpin(bp);
+    brelse(bp);
+  }
+  log_unreserve(ip->ndelay*DLOGBLK + DLOGINODE);
+  bunpromise(ip->dpromise);
+  ip->ndelay = 0;
+  ip->dpromise = 0;
+}
+
+// Allocate ip's delayed blocks, one after another so that
+// balloc() lays them out as a run, and log their data.
+// Caller must hold ip->lock, inside a transaction.
+static void
+iflush(struct inode *ip)
+{
+  struct buf *db, *bp;
+  uint bn, addr;
+  int fresh;
+
+  if(ip->ndelay == 0)
+    return;
+  for(bn = ip->dfirst; bn < ip->dfirst + ip->ndelay; bn++){
+    fresh = 0;
+    if((addr = bmap(ip, bn, &fresh)) == 0)
+      panic("iflush");  // the block was promised
+    db = bread(ip->dev, DBLOCK(ip->inum, bn));
+    bp = bnew(ip->dev, addr);
+    memmove(bp->data, db->data, BSIZE);
+    log_write(bp);
+    brelse(bp);
+    brelse(db);
+  }
+  idrop(ip);
+  iupdate(ip);
+}
+
+// Allocate the delayed blocks of every inode. Called by
+// logflush() as the last op of the transaction it is about
+// to commit. No other op runs meanwhile, and only ops drop
+// inode references, so no inode with delayed blocks, which
+// always has a reference, can leave the table.
+void
+iflushall(void)
+{
+  struct inode *ip;
+
+  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
+    if(ip->ndelay == 0)
+      continue;
+    ilock(ip);
+    iflush(ip);
+    iunlock(ip);
+  }
+}
+
 // Truncate inode (discard contents).
 // Caller must hold ip->lock.
 void
@@ -429,6 +706,8 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  idrop(ip);
+
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -449,6 +728,8 @@ itrunc(struct inode *ip)
   }
 
   ip->size = 0;
+  ip->raend = 0;
+  ip->goal = 0;
   iupdate(ip);
 }
 
@@ -464,6 +745,41 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Note that a reader of ip has just read block bn, and if
+// it is reading sequentially, start reading the blocks it
+// will want next. The window of blocks read ahead doubles,
+// up to RAMAX, while the reader keeps going, and collapses
+// when it skips about. Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint bn)
+{
+  uint b, end, addr;
+
+  if(bn + 1 == ip->ranext)
+    return;  // still in the same block
+  if(bn == ip->ranext){
+    ip->rawin = ip->rawin ? min(2 * ip->rawin, RAMAX) : 2;
+  } else {
+    ip->rawin = 0;
+    ip->raend = 0;
+  }
+  ip->ranext = bn + 1;
+  if(ip->rawin == 0)
+    return;
+
+  end = min(bn + 1 + ip->rawin, (ip->size + BSIZE - 1) / BSIZE);
+  for(b = max(ip->raend, bn + 1); b < end; b++){
+    // b is within the file, so bmap() will not allocate;
+    // a delayed block is in the cache already, as are
+    // those after it.
+    if(delayed(ip, b) || (addr = bmap(ip, b, 0)) == 0)
+      break;
+    breadahead(ip->dev, addr);
+  }
+  if(b > ip->raend)
+    ip->raend = b;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -480,10 +796,14 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    uint addr = bmap(ip, off/BSIZE);
-    if(addr == 0)
-      break;
-    bp = bread(ip->dev, addr);
+    if(delayed(ip, off/BSIZE)){
+      bp = bread(ip->dev, DBLOCK(ip->inum, off/BSIZE));  // pinned, so cached
+    } else {
+      uint addr = bmap(ip, off/BSIZE, 0);
+      if(addr == 0)
+        break;
+      bp = bread(ip->dev, addr);
+    }
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
       brelse(bp);
@@ -491,6 +811,13 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
       break;
     }
     brelse(bp);
+    // only read() is worth following; in particular,
+    // segload()'s page-ins must not reset its window.
+    // not before brelse(): logflush() locks every block
+    // it installs, in no particular order, so holding bp
+    // while waiting for another block could deadlock.
+    if(user_dst)
+      readahead(ip, off/BSIZE);
   }
   return tot;
 }
@@ -502,11 +829,14 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 // Returns the number of bytes successfully written.
 // If the return value is less than the requested n,
 // there was an error of some kind.
+// A plain file's new blocks are delayed, and get disk
+// blocks only when the transaction commits; see idelay().
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  int grew = 0;
 
   if(off > ip->size || off + n < off)
     return -1;
@@ -514,12 +844,40 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     return -1;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    uint addr = bmap(ip, off/BSIZE);
-    if(addr == 0)
-      break;
-    bp = bread(ip->dev, addr);
+    uint bn = off/BSIZE;
     m = min(n - tot, BSIZE - off%BSIZE);
+    if(delayed(ip, bn)){
+      bp = bread(ip->dev, DBLOCK(ip->inum, bn));  // pinned, so cached
+      if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1){
+        brelse(bp);
+        break;
+      }
+      brelse(bp);
+      continue;
+    }
+    if(ip->type == T_FILE && bn*BSIZE >= ip->size){
+      if(idelay(ip, bn, user_src, src, off % BSIZE, m) < 0)
+        break;
+      continue;
+    }
+
+    int fresh = 0;
+    uint addr = bmap(ip, bn, &fresh);
+    if(addr == 0){
+      grew = 1;  // bmap() may have added an indirect block
+      break;
+    }
+    grew |= fresh;
+    // a new block starts at or past the end of the file, so
+    // it need neither be read nor zeroed on disk first: all
+    // of it that is not written here is beyond the end.
+    if(fresh)
+      bp = bnew(ip->dev, addr);
+    else
+      bp = bread(ip->dev, addr);
     if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
+      if(fresh)
+        log_write(bp);  // don't leave the block's old contents
       brelse(bp);
       break;
     }
@@ -527,13 +885,17 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     brelse(bp);
   }
 
-  if(off > ip->size)
+  if(off > ip->size){
     ip->size = off;
+    grew = 1;
+  }
 
-  // write the i-node back to disk even if the size didn't change
-  // because the loop above might have called bmap() and added a new
-  // block to ip->addrs[].
-  iupdate(ip);
+  // write the i-node back to disk if the loop above grew the
+  // file or bmap() added a block to ip->addrs[]. rewriting
+  // data in place leaves the i-node as it was, and need not
+  // log its block.
+  if(grew)
+    iupdate(ip);
 
   return tot;
 }
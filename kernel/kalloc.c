@@ -1,6 +1,17 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// Each CPU keeps its own free list, so kalloc() and kfree()
+// normally take only that CPU's lock. A CPU whose list runs
+// dry refills it with a batch of pages from a shared pool,
+// and spills a batch back when its list grows too long. If
+// the pool is empty as well, it steals half of another CPU's
+// free list.
+//
+// Pages may be shared copy-on-write by several page tables,
+// so each page has a reference count; kfree() only returns a
+// page to a free list when the last reference is dropped.
 
 #include "types.h"
 #include "param.h"
@@ -9,6 +20,9 @@
 #include "riscv.h"
 #include "defs.h"
 
+#define KMEM_BATCH  32             // pages moved per refill or spill
+#define KMEM_HIGH   (2*KMEM_BATCH) // spill when a CPU holds more than this
+
 void freerange(void *pa_start, void *pa_end);
 
 extern char end[]; // first address after kernel.
@@ -18,15 +32,35 @@ struct run {
   struct run *next;
 };
 
+// per-CPU free list.
+struct kmem {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+  uint nalloc;   // pages handed out by kalloc() on this CPU
+  uint hits;     // ... of which came straight off freelist
+  uint refills;  // batches taken from the shared pool
+  uint steals;   // pages stolen from other CPUs
+} kmem[NCPU];
+
+// reference counts, one per physical page, updated with atomics
+// so that sharing a page does not take any allocator lock.
+#define PA2REF(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+int pgref[PA2REF(PHYSTOP)];
+
+// shared pool of pages not cached by any CPU.
 struct {
   struct spinlock lock;
   struct run *freelist;
-} kmem;
+  int nfree;
+} kpool;
 
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kmem[i].lock, "kmem");
+  initlock(&kpool.lock, "kpool");
   freerange(end, (void*)PHYSTOP);
 }
 
@@ -35,48 +69,255 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    pgref[PA2REF(p)] = 1;
     kfree(p);
+  }
+}
+
+// Detach the pages after the first keep pages of *list.
+// Returns the number of pages detached; *head and *tail
+// delimit the detached chain.
+static int
+ksplit(struct run **list, int keep, struct run **head, struct run **tail)
+{
+  struct run *r, **pp;
+  int n;
+
+  pp = list;
+  for(; keep > 0 && *pp; keep--)
+    pp = &(*pp)->next;
+  *head = *pp;
+  *pp = 0;
+  n = 0;
+  for(r = *head; r; r = r->next){
+    *tail = r;
+    n++;
+  }
+  return n;
+}
+
+// Detach the first n pages of *list.
+// Returns the number of pages detached; *head and *tail
+// delimit the detached chain.
+static int
+kcut(struct run **list, int n, struct run **head, struct run **tail)
+{
+  struct run *r;
+  int i;
+
+  *head = *list;
+  r = 0;
+  for(i = 0; i < n && *list; i++){
+    r = *list;
+    *list = r->next;
+  }
+  if(r)
+    r->next = 0;
+  *tail = r;
+  return i;
+}
+
+// Put the chain head..tail of n pages on km's free list.
+// Caller must hold km->lock.
+static void
+kpush(struct kmem *km, struct run *head, struct run *tail, int n)
+{
+  tail->next = km->freelist;
+  km->freelist = head;
+  km->nfree += n;
+}
+
+// Add a reference to the page at pa, which another
+// page table is about to share.
+void
+krefinc(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("krefinc");
+  __sync_fetch_and_add(&pgref[PA2REF(pa)], 1);
+}
+
+// Return the number of references to the page at pa.
+int
+krefcnt(void *pa)
+{
+  return pgref[PA2REF(pa)];
 }
 
-// Free the page of physical memory pointed at by pa,
-// which normally should have been returned by a
+// Drop a reference to the page of physical memory pointed
+// at by pa, which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// The page is freed when its last reference goes away.
 void
 kfree(void *pa)
 {
-  struct run *r;
+  struct run *r, *head, *tail;
+  struct kmem *km;
+  int n;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  n = __sync_sub_and_fetch(&pgref[PA2REF(pa)], 1);
+  if(n > 0)
+    return;
+  if(n < 0)
+    panic("kfree: ref");
+
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  km = &kmem[cpuid()];
+
+  acquire(&km->lock);
+  r->next = km->freelist;
+  km->freelist = r;
+  km->nfree++;
+  n = 0;
+  if(km->nfree > KMEM_HIGH){
+    // keep the most recently freed (cache-warm) pages,
+    // give the rest back to the pool.
+    n = ksplit(&km->freelist, KMEM_BATCH, &head, &tail);
+    km->nfree -= n;
+  }
+  release(&km->lock);
+
+  if(n > 0){
+    acquire(&kpool.lock);
+    tail->next = kpool.freelist;
+    kpool.freelist = head;
+    kpool.nfree += n;
+    release(&kpool.lock);
+  }
+  pop_off();
+}
+
+// Take a batch of pages for CPU id, first from the shared
+// pool and then from the other CPUs. Returns one page for
+// the caller and puts the rest on kmem[id].freelist.
+// Returns 0 if there is no free memory anywhere.
+// Holds at most one lock at a time, so that two CPUs
+// stealing from each other cannot deadlock.
+static struct run *
+krefill(int id)
+{
+  struct kmem *km = &kmem[id];
+  struct kmem *victim;
+  struct run *head, *tail, *r;
+  int n, steal;
+
+  steal = 0;
+  acquire(&kpool.lock);
+  n = kcut(&kpool.freelist, KMEM_BATCH, &head, &tail);
+  kpool.nfree -= n;
+  release(&kpool.lock);
+
+  for(int i = 1; n == 0 && i < NCPU; i++){
+    victim = &kmem[(id + i) % NCPU];
+    acquire(&victim->lock);
+    if(victim->nfree > 0){
+      n = ksplit(&victim->freelist, victim->nfree / 2, &head, &tail);
+      victim->nfree -= n;
+      steal = 1;
+    }
+    release(&victim->lock);
+  }
+
+  if(n == 0)
+    return 0;
+
+  r = head;
+  head = head->next;
+  acquire(&km->lock);
+  if(head)
+    kpush(km, head, tail, n - 1);
+  if(steal)
+    km->steals += n;
+  else
+    km->refills++;
+  km->nalloc++;
+  release(&km->lock);
+  return r;
+}
+
+// Take a page off this CPU's free list, refilling it if
+// it is empty. Returns 0 if there is no free memory.
+static struct run *
+ktake(void)
+{
+  struct run *r;
+  struct kmem *km;
+  int id;
+
+  push_off();
+  id = cpuid();
+  km = &kmem[id];
+
+  acquire(&km->lock);
+  r = km->freelist;
+  if(r){
+    km->freelist = r->next;
+    km->nfree--;
+    km->nalloc++;
+    km->hits++;
+  }
+  release(&km->lock);
+
+  if(r == 0)
+    r = krefill(id);
+  pop_off();
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+//
+// When memory runs out, kalloc() takes pages back from the
+// buffer cache with bshrink(), which acquires bcache.lock and
+// bucket locks; so the caller must not hold either of those.
+// Buffer sleeplocks are fine: bshrink() frees only unused
+// buffers, and takes none.
 void *
 kalloc(void)
 {
   struct run *r;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  r = ktake();
 
-  if(r)
+  // out of memory: take pages back from the buffer cache,
+  // and try once more. Someone else may get those pages
+  // first, in which case this fails like any other kalloc()
+  // with memory short.
+  if(r == 0 && bshrink(KMEM_BATCH) > 0)
+    r = ktake();
+
+  if(r){
     memset((char*)r, 5, PGSIZE); // fill with junk
+    pgref[PA2REF(r)] = 1;
+  }
   return (void*)r;
 }
+
+// Print per-CPU allocator statistics. For debugging.
+// Runs when user types ^P on console.
+// No lock to avoid wedging a stuck machine further.
+void
+kmemdump(void)
+{
+  struct kmem *km;
+
+  printf("kmem: %d pages in pool\n", kpool.nfree);
+  for(int i = 0; i < NCPU; i++){
+    km = &kmem[i];
+    if(km->nalloc == 0 && km->nfree == 0)
+      continue;
+    printf("cpu%d: free %d alloc %d hit %d refill %d steal %d\n",
+           i, km->nfree, km->nalloc, km->hits, km->refills, km->steals);
+  }
+}
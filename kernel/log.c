@@ -19,95 +19,217 @@
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// sleeps until the log has been committed.
+//
+// Commits are done by the logflush kernel thread, not by
+// the system calls. Once a transaction has its first block,
+// it stays open for LOGDELAY cycles so that the operations
+// of many processes join it, or until an op is short of log
+// space; then logflush waits for the ops in progress to end,
+// allocates the file blocks whose allocation writei() put
+// off (see iflushall() in fs.c), and commits the lot while
+// new ops wait. New ops can start
+// as soon as the commit is on disk and the writes that
+// install it have started, and fill the next transaction
+// while logflush waits for those writes.
 //
 // The log is a physical re-do log containing disk blocks.
-// The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
-//   block A
-//   block B
-//   block C
-//   ...
-// Log appends are synchronous.
-
-// Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged block# before commit.
+// Its size is chosen by mkfs. The on-disk log format:
+//   log super block, naming the oldest transaction to replay
+//   a ring of the remaining blocks, holding transactions:
+//     header block, containing seq and block #s for A, B, C, ...
+//     block A
+//     block B
+//     block C
+//     ...
+//   then the next transaction's header, and so on,
+//   wrapping round the end of the ring.
+// A transaction's blocks are written before its header, and
+// the header is the true point at which it commits. Recovery
+// replays transactions from the log super block's onward,
+// for as long as each header carries the next seq.
+//
+// The ring also holds old copies of blocks, file data among
+// them, so a copy that begins with LOGMAGIC is logged with
+// its first word zeroed and LOGESCAPE set on its number in
+// the header; only a header can then begin with LOGMAGIC.
+
+#define LOGMAGIC 0x6c6f6721
+#define LOGESCAPE 0x80000000  // in a header's block[]: first word was LOGMAGIC
+#define LOGMAXBLK ((BSIZE - 3*sizeof(uint)) / sizeof(uint))
+
+// Contents of a transaction's header block, used for both the
+// on-disk header block and to keep track in memory of logged
+// block# before commit.
 struct logheader {
+  uint magic;
+  uint seq;
   int n;
-  int block[LOGSIZE];
+  uint block[LOGMAXBLK];
+};
+
+// Contents of the log's first block.
+struct logsuper {
+  uint tail;       // ring index of the oldest transaction to replay
+  uint seq;        // its seq
 };
 
 struct log {
   struct spinlock lock;
   int start;
   int size;
+  int ring;        // blocks in the ring, after the log super block
+  int txmax;       // most blocks in one transaction
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
+  int full;        // an op waits for space; commit now.
+  int reserved;    // log blocks set aside for delayed blocks; see idelay()
+  struct proc *flusher; // the logflush thread
   int dev;
-  struct logheader lh;
+  struct logheader lh;  // the transaction ops are joining
+
+  // private to logflush, so log.lock need not be held.
+  struct logheader ct;  // the transaction being committed and installed
+  struct buf *tbuf[LOGMAXBLK];
+  char escaped[LOGMAXBLK]; // which of log.ct's logged copies are escaped
+  uint head;       // ring position for the next transaction
+  uint disktail;   // ring position the log super block names
+  uint seq;        // seq for the next transaction
 };
 struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void logflush(void);
 
 void
 initlog(int dev, struct superblock *sb)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  if (sizeof(struct logheader) > BSIZE)
     panic("initlog: too big logheader");
 
   initlock(&log.lock, "log");
   log.start = sb->logstart;
   log.size = sb->nlog;
   log.dev = dev;
+
+  // a transaction's blocks stay pinned in the cache until it
+  // is installed, while the next one fills, so two of them
+  // must fit in the NBUF buffers the cache never gives back.
+  log.ring = log.size - 1;
+  log.txmax = log.ring - 1;
+  if(log.txmax > LOGMAXBLK)
+    log.txmax = LOGMAXBLK;
+  if(log.txmax > LOGTXMAX)
+    log.txmax = LOGTXMAX;
+  if(log.txmax < MAXOPBLOCKS)
+    panic("initlog: log too small");
+
   recover_from_log();
+  log.flusher = kthread(logflush, "logflush");
+}
+
+// The disk block at ring position pos.
+static int
+logblock(uint pos)
+{
+  return log.start + 1 + pos % log.ring;
+}
+
+// Start copying the blocks of log.ct, whose header is at ring
+// position pos, from log to their home locations. Locks them
+// all; install_wait() waits for the writes and unlocks them.
+static void
+install_start(int recovering, uint pos)
+{
+  struct logheader *lh = &log.ct;
+  int tail;
+
+  if(recovering){
+    for (tail = 0; tail < lh->n; tail++)
+      breadahead(log.dev, logblock(pos+tail+1));
+  }
+  for (tail = 0; tail < lh->n; tail++) {
+    log.tbuf[tail] = bread(log.dev, lh->block[tail]); // read dst
+    // after a commit, the pinned dst in the cache already
+    // holds what the log does; only recovery must copy.
+    if(recovering){
+      struct buf *lbuf = bread(log.dev, logblock(pos+tail+1)); // read log block
+      memmove(log.tbuf[tail]->data, lbuf->data, BSIZE);  // copy block to dst
+      if(log.escaped[tail])
+        *(uint*)log.tbuf[tail]->data = LOGMAGIC;
+      brelse(lbuf);
+    }
+    bwritestart(log.tbuf[tail]);  // write dst to disk
+  }
 }
 
-// Copy committed blocks from log to their home location
 static void
-install_trans(int recovering)
+install_wait(int recovering)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
+  for (tail = 0; tail < log.ct.n; tail++) {
+    bwait(log.tbuf[tail]);
     if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+      bunpin(log.tbuf[tail]);
+    brelse(log.tbuf[tail]);
   }
 }
 
-// Read the log header from disk into the in-memory log header
+// Write the log super block, naming the transaction at ring
+// position tail, with sequence number seq, as the oldest one
+// to replay.
 static void
-read_head(void)
+write_super(uint tail, uint seq)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = bnew(log.dev, log.start);
+  struct logsuper *ls = (struct logsuper *) (buf->data);
+
+  ls->tail = tail % log.ring;
+  ls->seq = seq;
+  bwrite(buf);
+  brelse(buf);
+  log.disktail = tail;
+}
+
+// Read the header at ring position pos into log.ct.
+// Returns 0 unless it is the header of transaction seq.
+static int
+read_head(uint pos, uint seq)
+{
+  struct buf *buf = bread(log.dev, logblock(pos));
   struct logheader *lh = (struct logheader *) (buf->data);
-  int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  int i, ok;
+
+  ok = lh->magic == LOGMAGIC && lh->seq == seq &&
+    lh->n > 0 && lh->n <= log.txmax;
+  if(ok){
+    log.ct.n = lh->n;
+    for (i = 0; i < log.ct.n; i++) {
+      log.ct.block[i] = lh->block[i] & ~LOGESCAPE;
+      log.escaped[i] = (lh->block[i] & LOGESCAPE) != 0;
+    }
   }
   brelse(buf);
+  return ok;
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Write log.ct's header to ring position pos.
+// This is the true point at which the transaction commits.
 static void
-write_head(void)
+write_head(uint pos)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = bnew(log.dev, logblock(pos));
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->magic = LOGMAGIC;
+  hb->seq = log.ct.seq;
+  hb->n = log.ct.n;
+  for (i = 0; i < log.ct.n; i++) {
+    hb->block[i] = log.ct.block[i];
+    if(log.escaped[i])
+      hb->block[i] |= LOGESCAPE;
   }
   bwrite(buf);
   brelse(buf);
@@ -116,10 +238,21 @@ write_head(void)
 static void
 recover_from_log(void)
 {
-  read_head();
-  install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  struct buf *buf = bread(log.dev, log.start);
+  struct logsuper *ls = (struct logsuper *) (buf->data);
+  uint pos = ls->tail % log.ring, seq = ls->seq;
+
+  brelse(buf);
+  // replay each committed transaction in turn.
+  while(read_head(pos, seq)){
+    install_start(1, pos);
+    install_wait(1);
+    pos += log.ct.n + 1;
+    seq++;
+  }
+  log.head = pos;
+  log.seq = seq;
+  write_super(pos, seq); // clear the log
 }
 
 // called at the start of each FS system call.
@@ -130,8 +263,12 @@ begin_op(void)
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.reserved + (log.outstanding+1)*MAXOPBLOCKS > log.txmax){
       // this op might exhaust log space; wait for commit.
+      if(!log.full){
+        log.full = 1;
+        timerwake(log.flusher);
+      }
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
@@ -142,69 +279,163 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// the transaction it joined commits later, in logflush().
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
-  }
+  // begin_op() may be waiting for log space, and
+  // decrementing log.outstanding has decreased the
+  // amount of reserved space; logflush() may be
+  // waiting for the last op to end.
+  wakeup(&log);
   release(&log.lock);
+}
+
+// The logflush kernel thread: commit each transaction once
+// it has been open for LOGDELAY cycles or the log is full,
+// then install it while the next one fills.
+//
+// the install writes start before new ops are let in, so
+// that logflush holds every block it installs before any op
+// can hold one; an op that wants one waits for its write.
+static void
+logflush(void)
+{
+  uint pos;
+
+  acquire(&log.lock);
+  for(;;){
+    while(log.lh.n == 0 && log.reserved == 0)
+      sleep(&log.lh, &log.lock);
+
+    // let more ops join, unless some op is short of space.
+    if(!log.full){
+      release(&log.lock);
+      timersleep(LOGDELAY);
+      acquire(&log.lock);
+    }
+
+    // close the transaction to new ops and wait for the
+    // ones in it to end.
+    log.committing = 1;
+    log.full = 0;
+    while(log.outstanding > 0)
+      sleep(&log, &log.lock);
+
+    // give delayed blocks their disk blocks, as the
+    // transaction's last op.
+    if(log.reserved > 0){
+      log.outstanding = 1;
+      release(&log.lock);
+      iflushall();
+      acquire(&log.lock);
+      log.outstanding = 0;
+      if(log.reserved != 0)
+        panic("logflush: reserved");
+    }
+    if(log.lh.n == 0){
+      // its delayed blocks were all truncated away.
+      log.committing = 0;
+      wakeup(&log);
+      continue;
+    }
+    log.ct = log.lh;
+    log.lh.n = 0;
+    release(&log.lock);
 
-  if(do_commit){
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
+    pos = log.head;
     commit();
+    install_start(0, pos); // Now install writes to home locations
+
     acquire(&log.lock);
     log.committing = 0;
     wakeup(&log);
     release(&log.lock);
+
+    install_wait(0);
+
+    acquire(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy modified blocks from cache to log.ct's place in the
+// ring, after its header at ring position pos.
+// Starts all the writes before waiting for any.
 static void
-write_log(void)
+write_log(uint pos)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+  for (tail = 0; tail < log.ct.n; tail++) {
+    log.tbuf[tail] = bnew(log.dev, logblock(pos+tail+1)); // log block
+    struct buf *from = bread(log.dev, log.ct.block[tail]); // cache block
+    memmove(log.tbuf[tail]->data, from->data, BSIZE);
+    log.escaped[tail] = *(uint*)from->data == LOGMAGIC;
+    if(log.escaped[tail])
+      *(uint*)log.tbuf[tail]->data = 0;
+    bwritestart(log.tbuf[tail]);  // write the log
     brelse(from);
-    brelse(to);
+  }
+  for (tail = 0; tail < log.ct.n; tail++) {
+    bwait(log.tbuf[tail]);
+    brelse(log.tbuf[tail]);
   }
 }
 
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
-  }
+  uint pos = log.head;
+
+  // every earlier transaction is installed, so the log super
+  // block need only move on when this one would overwrite
+  // what it names.
+  if(pos + log.ct.n + 1 - log.disktail > log.ring)
+    write_super(pos, log.seq);
+
+  log.ct.seq = log.seq;
+  write_log(pos);  // Write modified blocks from cache to log
+  write_head(pos); // Write header to disk -- the real commit
+  log.head = pos + log.ct.n + 1;
+  log.seq++;
+}
+
+// Set aside n log blocks in the open transaction, for an op
+// that leaves work for its commit to log; see idelay().
+// Must be within the op's MAXOPBLOCKS.
+void
+log_reserve(int n)
+{
+  acquire(&log.lock);
+  if (log.outstanding < 1)
+    panic("log_reserve outside of trans");
+  if (log.lh.n == 0 && log.reserved == 0)
+    wakeup(&log.lh);
+  log.reserved += n;
+  release(&log.lock);
+}
+
+// Give back n log blocks set aside by log_reserve(), once
+// the work they were for is logged or dropped.
+void
+log_unreserve(int n)
+{
+  acquire(&log.lock);
+  log.reserved -= n;
+  if (log.reserved < 0)
+    panic("log_unreserve");
+  wakeup(&log);
+  release(&log.lock);
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
-// commit()/write_log() will do the disk write.
+// commit()/write_log() will do the disk write, and the first
+// block of a transaction starts logflush()'s count down.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -217,7 +448,7 @@ log_write(struct buf *b)
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.txmax)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -230,7 +461,8 @@ log_write(struct buf *b)
   if (i == log.lh.n) {  // Add new block to log?
     bpin(b);
     log.lh.n++;
+    if (log.lh.n == 1)
+      wakeup(&log.lh);
   }
   release(&log.lock);
 }
-
@@ -7,9 +7,16 @@
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define LOGSIZE      200  // blocks in the on-disk log mkfs makes, unless told
+#define LOGTXMAX     (MAXOPBLOCKS*6)  // most blocks in one log transaction
+#define NBUF         (LOGTXMAX*2 + MAXOPBLOCKS*3)  // disk block cache buffers it never gives up
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
 #define MAXNUM         5   // max num of process in a queue for mlfq
-#define AGINGNUM      64   // aging
\ No newline at end of file
+#define AGINGNUM      64   // aging
+#define BALANCEINT    10   // ticks between run queue balancing
+#define NSCHED         5   // number of scheduling policies
+#define TICKINTERVAL 1000000 // timer cycles per tick; about 1/10th second in qemu
+#define BCACHEFRAC     8   // disk block cache grows to at most 1/8 of memory
+#define RAMAX         32   // most blocks read ahead of a sequential reader
+#define LOGDELAY      (TICKINTERVAL/20) // timer cycles a transaction stays open for more ops
\ No newline at end of file
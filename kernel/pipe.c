@@ -76,28 +76,36 @@ pipeclose(struct pipe *pi, int writable)
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
-  int i = 0;
+  int i = 0, end;
   struct proc *pr = myproc();
 
-  acquire(&pi->lock);
   while(i < n){
-    if(pi->readopen == 0 || killed(pr)){
-      release(&pi->lock);
-      return -1;
-    }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
-      sleep(&pi->nwrite, &pi->lock);
-    } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-        break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+    // copyin() below cannot page in the executable while
+    // pi->lock is held, so fault in a pipeful at a time.
+    end = n - i > PIPESIZE ? i + PIPESIZE : n;
+    uvmprefault(pr->pagetable, addr + i, end - i, PTE_R);
+    acquire(&pi->lock);
+    while(i < end){
+      if(pi->readopen == 0 || killed(pr)){
+        release(&pi->lock);
+        return -1;
+      }
+      if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+        wakeup(&pi->nread);
+        sleep(&pi->nwrite, &pi->lock);
+      } else {
+        char ch;
+        if(copyin(pr->pagetable, &ch, addr + i, 1) == -1){
+          n = i;
+          break;
+        }
+        pi->data[pi->nwrite++ % PIPESIZE] = ch;
+        i++;
+      }
     }
+    wakeup(&pi->nread);
+    release(&pi->lock);
   }
-  wakeup(&pi->nread);
-  release(&pi->lock);
 
   return i;
 }
@@ -109,6 +117,12 @@ piperead(struct pipe *pi, uint64 addr, int n)
   struct proc *pr = myproc();
   char ch;
 
+  // a read returns at most a pipeful; fault in that
+  // much, since copyout() cannot page in the executable
+  // while pi->lock is held.
+  if(n > PIPESIZE)
+    n = PIPESIZE;
+  uvmprefault(pr->pagetable, addr, n, PTE_W);
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
     if(killed(pr)){
@@ -4,30 +4,34 @@
 #include "riscv.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "sched.h"
 #include "defs.h"
 
-struct proc *front(struct Queue *q);
-
-struct proc *front(struct Queue *q);
-void pushQueue(struct Queue *q, struct proc *element);
-void popQueue(struct Queue *q);
-
-extern void sgenrand(unsigned long);
-extern long genrand(void);
-extern long random_gen(long);
-
 struct cpu cpus[NCPU];
 
 struct proc proc[NPROC];
 
-struct Queue mlfq[MAXNUM];
-
 struct proc *initproc;
 
+// Sleeping processes, hashed on their wait channel, so
+// that wakeup() only looks at processes that might be
+// waiting on chan. A sleeper links itself into its
+// bucket before it releases the condition lock, and
+// wakeup() unlinks it.
+// lock order: sq->lock, then p->lock.
+#define NSLEEPQ 61
+#define SLEEPQ(chan) (&sleepq[((uint64)(chan) >> 3) % NSLEEPQ])
+struct sleepq
+{
+  struct spinlock lock;
+  struct proc *head;
+} sleepq[NSLEEPQ];
+
 int nextpid = 1;
 struct spinlock pid_lock;
 
 extern void forkret(void);
+static void kthreadret(void);
 static void frefindProcess(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
@@ -62,20 +66,16 @@ void procinit(void)
 
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  for (int i = 0; i < NSLEEPQ; i++)
+    initlock(&sleepq[i].lock, "sleepq");
   for (p = proc; p < &proc[NPROC]; p++)
   {
     initlock(&p->lock, "proc");
     p->state = UNUSED;
     p->kstack = KSTACK((int)(p - proc));
+    p->timer.cpu = -1;
   }
-#ifdef MLFQ
-  for (int i = 0; i < MAXNUM; i++)
-  {
-    mlfq[i].front = 0;
-    mlfq[i].back = 0;
-    mlfq[i].size = 0;
-  }
-#endif
+  sched_init();
 }
 
 // Must be called with interrupts disabled,
@@ -146,6 +146,8 @@ allocproc(void)
 found:
   p->pid = allocpid();
   p->state = USED;
+  p->rqcpu = -1;
+  p->lastcpu = -1;
   p->creationTime = ticks;
   p->totalRunTime = 0;
 
@@ -172,14 +174,18 @@ found:
   p->context.ra = (uint64)forkret;
   p->context.sp = p->kstack + PGSIZE;
 
+  // scheduling class; fork() gives the child its parent's
+  p->policy = schedpolicy;
+  p->tickets = 1;
+
   // PBS Related fields
   p->priority = 60;
   p->numberOfRuns = 0;
   p->runTime = 0;
+  p->waitTime = 0;
 
   // MLFQ
-  p->priority = 0;
-  p->checkQueue = 0;
+  p->currentQueue = 0;
   p->timeQuantum = 1;
   p->queueCreationTime = ticks;
 
@@ -209,9 +215,12 @@ frefindProcess(struct proc *p)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
   p->sz = 0;
+  p->exe = 0;
+  p->nseg = 0;
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
+  p->kfn = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
@@ -295,12 +304,32 @@ void userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
   release(&p->lock);
 }
 
+// Start a kernel thread that runs fn(), which must never
+// return. It has no user memory, and cannot be killed.
+struct proc *kthread(void (*fn)(void), char *name)
+{
+  struct proc *p;
+
+  if ((p = allocproc()) == 0)
+    panic("kthread");
+  p->kfn = fn;
+  p->context.ra = (uint64)kthreadret;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  setrunnable(p);
+
+  release(&p->lock);
+  return p;
+}
+
 // Grow or shrink user memory by n bytes.
+// Growing only reserves the address range; vmfault()
+// allocates each page when it is first touched.
 // Return 0 on success, -1 on failure.
 int growproc(int n)
 {
@@ -310,10 +339,11 @@ int growproc(int n)
   sz = p->sz;
   if (n > 0)
   {
-    if ((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0)
+    if (sz + n > TRAPFRAME)
     {
       return -1;
     }
+    sz += n;
   }
   else if (n < 0)
   {
@@ -352,6 +382,10 @@ int fork(void)
   // copy trace mask
   np->tracemask = p->tracemask;
 
+  // the child is scheduled like its parent
+  np->policy = p->policy;
+  np->tickets = p->tickets;
+
   // Cause fork to return 0 in the child.
   np->trapframe->a0 = 0;
 
@@ -360,6 +394,11 @@ int fork(void)
     if (p->ofile[i])
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
+  // the child pages in the same executable on demand.
+  if (p->exe)
+    np->exe = idup(p->exe);
+  np->nseg = p->nseg;
+  memmove(np->seg, p->seg, sizeof(p->seg));
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
@@ -372,7 +411,7 @@ int fork(void)
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  setrunnable(np);
   release(&np->lock);
 
   return pid;
@@ -417,8 +456,11 @@ void exit(int status)
 
   begin_op();
   iput(p->cwd);
+  if (p->exe)
+    iput(p->exe);
   end_op();
   p->cwd = 0;
+  p->exe = 0;
 
   acquire(&wait_lock);
 
@@ -449,6 +491,10 @@ int wait(uint64 addr)
   int havekids, pid;
   struct proc *p = myproc();
 
+  // the status is copied out with locks held.
+  if (addr != 0)
+    uvmprefault(p->pagetable, addr, sizeof(int), PTE_W);
+
   acquire(&wait_lock);
 
   for (;;)
@@ -501,6 +547,10 @@ int waitx(uint64 addr, int *runTime, int *waitTime)
   int havekids, pid;
   struct proc *p = myproc();
 
+  // the status is copied out with locks held.
+  if (addr != 0)
+    uvmprefault(p->pagetable, addr, sizeof(int), PTE_W);
+
   acquire(&wait_lock);
 
   for (;;)
@@ -549,48 +599,6 @@ int waitx(uint64 addr, int *runTime, int *waitTime)
   }
 }
 
-int check(struct proc *p)
-{
-  if (p->runTime + p->waitTime == 0)
-  {
-    return 0;
-  }
-  else
-  {
-    return 1;
-  }
-}
-
-int nice_priority(struct proc *p)
-{
-  int niceness, dp;
-  int x = check(p);
-  if (x == 0)
-  {
-    niceness = 5;
-  }
-  else
-  {
-    niceness = p->waitTime * 10;
-    niceness /= (p->runTime + p->waitTime);
-  }
-  dp = p->priority - niceness + 5;
-  if (dp < 0)
-  {
-    dp = 0;
-  }
-  int retVal;
-  if (dp > 100)
-  {
-    retVal = 100;
-  }
-  else
-  {
-    retVal = dp;
-  }
-  return retVal;
-}
-
 void set_priority(int priority, int pid, int *old)
 {
   struct proc *p;
@@ -601,7 +609,10 @@ void set_priority(int priority, int pid, int *old)
       acquire(&p->lock);
       *old = p->priority;
       p->priority = priority;
+      if (p->state == RUNNING)
+        account(p);
       p->runTime = 0;
+      sched_reprioritize(p);
       release(&p->lock);
       if (*old > priority)
         yield();
@@ -609,111 +620,20 @@ void set_priority(int priority, int pid, int *old)
   }
 }
 
-void update_time(void)
-{
-  struct proc *p;
-  for (p = proc; p < &proc[NPROC]; p++)
-  {
-    acquire(&p->lock);
-    if (p->state == RUNNING)
-    {
-      p->totalRunTime++;
-#ifdef PBS
-      p->runTime++;
-#endif
-#ifdef MLFQ
-      p->queueRunTime[p->priority]++;
-      p->timeQuantum--;
-#endif
-    }
-#ifdef PBS
-    else if (p->state == SLEEPING)
-    {
-      p->waitTime++;
-    }
-#endif
-    release(&p->lock);
-  }
-  #ifdef MLFQ
-    // for(p = proc; p < &proc[NPROC]; p++){
-    //   if(p->pid >= 4 && p->pid <= 13){
-    //     printf("%d %d %d\n", p->pid, p->priority, ticks);
-    //   }
-    // }
-  #endif
-}
-
-void change(struct proc *p, struct cpu *c)
-{
-#ifdef RR
-  release(&p->lock);
-#endif
-#ifdef FCFS
-  c->proc = 0;
-  release(&p->lock);
-#endif
-#ifdef PBS
-  c->proc = 0;
-  release(&p->lock);
-#endif
-#ifdef LBS
-  c->proc = 0;
-  release(&p->lock);
-#endif
-#ifdef MLFQ
-  c->proc = 0;
-  p->queueCreationTime = ticks;
-  release(&p->lock);
-#endif
-  return;
-}
-
-void execute(struct proc *processToExecute, struct cpu *c)
-{
-#ifdef FCFS
-  processToExecute->state = RUNNING;
-  c->proc = processToExecute;
-#endif
-#ifdef LBS
-  processToExecute->state = RUNNING;
-  c->proc = processToExecute;
-#endif
-#ifdef PBS
-  processToExecute->state = RUNNING;
-  processToExecute->numberOfRuns++;
-  processToExecute->runTime = 0;
-  processToExecute->waitTime = 0;
-  c->proc = processToExecute;
-#endif
-#ifdef MLFQ
-  processToExecute->timeQuantum = (processToExecute->priority) * 2;
-  processToExecute->state = RUNNING;
-  c->proc = processToExecute;
-  processToExecute->numberOfRuns++;
-#endif
-  return;
-}
-
-void exchange(struct Queue *q, int current)
-{
-  struct proc *temp = q->processes[current];
-  q->processes[current] = q->processes[(current + 1) % (NPROC + 1)];
-  q->processes[(current + 1) % (NPROC + 1)] = temp;
-  return;
-}
-
-void changeMLFQqueue(struct Queue *q, struct proc *p)
+// Charge p, which is running, for the ticks since it was
+// last charged, and return how many there were. Run times
+// are brought up to date only when something needs them,
+// rather than by sweeping proc[] on every tick.
+// p->lock must be held.
+int account(struct proc *p)
 {
-  q->back--;
-  q->size--;
-
-  if (q->back < 0)
-  {
-    q->back = NPROC;
-  }
+  int n = ticks - p->lastScheduled;
 
-  p->checkQueue = 0;
-  return;
+  p->lastScheduled = ticks;
+  p->totalRunTime += n;
+  p->runTime += n;
+  p->queueRunTime[p->currentQueue] += n;
+  return n;
 }
 
 // Per-CPU process scheduler.
@@ -723,241 +643,50 @@ void changeMLFQqueue(struct Queue *q, struct proc *p)
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
-
+// Which process runs next is up to the scheduling
+// classes in sched.c.
 void scheduler(void)
 {
+  struct proc *p;
   struct cpu *c = mycpu();
 
   c->proc = 0;
+  c->online = 1;
   for (;;)
   {
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
-#ifdef RR
-    struct proc *p;
-    for (p = proc; p < &proc[NPROC]; p++)
-    {
-      acquire(&p->lock);
-      if (p->state == RUNNABLE)
-      {
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      change(p, c);
-    }
-#endif
-#ifdef FCFS
-    struct proc *p;
-    // iterate through process table
-    for (p = proc; p < &proc[NPROC]; p++)
-    {
-      struct proc *findProcess = 0;
-      for (p = proc; p < &proc[NPROC]; p++)
-      {
-        acquire(&p->lock);
-        if (p->state == RUNNABLE)
-        {
-          if (findProcess == 0)
-          {
-            findProcess = p;
-          }
-          else if (findProcess->creationTime > p->creationTime)
-          {
-            findProcess = p;
-          }
-        }
-        release(&p->lock);
-      }
 
-      if (findProcess != 0)
-      {
-        acquire(&findProcess->lock);
-        // execute the process
-        if (findProcess->state == RUNNABLE)
-        {
-          execute(findProcess, c);
-          swtch(&c->context, &findProcess->context);
-        }
-        change(findProcess, c);
-      }
-    }
-#endif
-#ifdef PBS
-    struct proc *p;
-    struct proc *findProcess = 0;
-    for (p = proc; p < &proc[NPROC]; p++)
-    {
-      acquire(&p->lock);
-      if (p->state == RUNNABLE)
-      {
-        if (findProcess == 0)
-        {
-          findProcess = p;
-          continue;
-        }
-        else if (nice_priority(findProcess) > nice_priority(p))
-        {
-          release(&findProcess->lock);
-          findProcess = p;
-          continue;
-        }
-        else if (nice_priority(findProcess) == nice_priority(p))
-        {
-          if (findProcess->numberOfRuns > p->numberOfRuns || findProcess->numberOfRuns == p->numberOfRuns)
-          {
-            int flag = 0;
-            if (findProcess->numberOfRuns == p->numberOfRuns)
-            {
-              flag = 1;
-            }
-            if (flag == 1)
-            {
-              if (findProcess->creationTime < p->creationTime)
-              {
-                release(&findProcess->lock);
-                findProcess = p;
-                continue;
-              }
-            }
-            else
-            {
-              release(&findProcess->lock);
-              findProcess = p;
-              continue;
-            }
-          }
-        }
-      }
-      release(&p->lock);
-    }
-    if (findProcess == 0)
+    p = sched_next(c);
+    if (p == 0)
     {
+      sched_idle(c);
       continue;
     }
-    execute(findProcess, c);
-    swtch(&c->context, &findProcess->context);
-    change(findProcess, c);
-#endif
-#ifdef LBS
-    int tickets_assigned = 0;
-    int totalTickets = 0;
-
-    for (p = proc; p < &proc[NPROC]; p++)
-    {
-      if (p->state == RUNNABLE)
-        //   continue;
-        // else
-        totalTickets = totalTickets + p->tickets;
-    }
-    // we have found the total number of tickets
 
-    long num_choose = random_gen(totalTickets);
-    // Loop over process table looking for process to run.
-    for (p = proc; p < &proc[NPROC]; p++)
+    // p may still be on its way into sched() on another
+    // cpu; acquiring p->lock waits for it to get there.
+    acquire(&p->lock);
+    if (p->state == RUNNABLE)
     {
-      acquire(&p->lock);
-      if (p->state != RUNNABLE)
-      {
-        release(&p->lock);
-        continue;
-      }
-      tickets_assigned += p->tickets;
-      // we don't need this process if it has ticjets less than findProcess number
-      if (tickets_assigned < num_choose)
-      {
-        release(&p->lock);
-        continue;
-      }
-      execute(p, c);
+      // Switch to chosen process.  It is the process's job
+      // to release its lock and then reacquire it
+      // before jumping back to us.
+      p->state = RUNNING;
+      p->numberOfRuns++;
+      p->lastcpu = c - cpus;
+      // PBS niceness counts from here.
+      p->runTime = 0;
+      p->waitTime = 0;
+      p->lastScheduled = ticks;
+      c->proc = p;
       swtch(&c->context, &p->context);
-      // Process is done running
-      change(p, c);
-      break;
-    }
-#endif
-#ifdef MLFQ
-    struct proc *p;
-    struct proc *findProcess = 0;
-
-    // Implement Aging
-    // iterate throguh the process table
-    for (p = proc; p < &proc[NPROC]; p++)
-    {
-      if (p->state == RUNNABLE && ticks - p->queueCreationTime >= AGINGNUM)
-      {
-        p->queueCreationTime = ticks;
-        if (p->checkQueue)
-        {
-          struct Queue *q;
-          q = &mlfq[p->priority];
-          for (int curr = q->front; curr != q->back; curr = (curr + 1) % (NPROC + 1))
-          {
-            if (q->processes[curr]->pid == p->pid)
-            {
-              exchange(q, curr);
-            }
-          }
-          changeMLFQqueue(q, p);
-        }
-        // reducing the priority of the process
-        if (p->priority != 0){
-          p->priority--; 
-        }
-      }
-    }
-    // iterate through the process table
-    for (p = proc; p < &proc[NPROC]; p++)
-    {
-      // acquire lock to access critical state
-      acquire(&p->lock);
-      // if process is runnable, but is not in any queue
-      // it is pushed insed the queue, and checkqueue is set to 1
-      if (p->state == RUNNABLE && p->checkQueue == 0)
-      {
-      // pushed to queue according to it's priority
-        pushQueue(&mlfq[p->priority], p);
-        p->checkQueue = 1;
-      }
-      release(&p->lock);
-    }
 
-    // maximum level in MLFQ cheduling is defined as 5
-    for (int level = 0; level < MAXNUM; level++)
-    {
-      // if queue of the particular num is not empty
-      while (mlfq[level].size != 0)
-      {
-        // process at the front of the queue is picked
-        // and it is popped from the queues
-        p = front(&mlfq[level]);
-        acquire(&p->lock);
-        popQueue(&mlfq[level]);
-        p->checkQueue = 0;
-        // if the state is runnable, the process is findProcess to be executed
-        if (p->state == RUNNABLE)
-        {
-          p->queueCreationTime = ticks;
-          findProcess = p;
-          break;
-        }
-        release(&p->lock);
-      }
-      if (findProcess != 0){
-        break;
-      }
+      // Process is done running for now.
+      // It should have changed its p->state before coming back.
+      c->proc = 0;
     }
-    if (!findProcess){
-      continue;
-    }
-    // the findProcess process is now executed
-    execute(findProcess, c);
-    swtch(&c->context, &findProcess->context);
-    change(findProcess, c);
-#endif
+    release(&p->lock);
   }
 }
 
@@ -982,6 +711,8 @@ void sched(void)
   if (intr_get())
     panic("sched interruptible");
 
+  account(p);
+
   intena = mycpu()->intena;
   swtch(&p->context, &mycpu()->context);
   mycpu()->intena = intena;
@@ -992,7 +723,7 @@ void yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  setrunnable(p);
   sched();
   release(&p->lock);
 }
@@ -1018,25 +749,45 @@ void forkret(void)
   usertrapret();
 }
 
+// A kernel thread's first scheduling by scheduler()
+// will swtch to kthreadret.
+static void kthreadret(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  p->kfn();
+  panic("kthread return");
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
 
+  struct sleepq *sq = SLEEPQ(chan);
+
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we hold sq->lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks sq->lock),
   // so it's okay to release lk.
 
+  acquire(&sq->lock);
   acquire(&p->lock); // DOC: sleeplock1
   release(lk);
 
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->lastSlept = ticks;
+  p->sqnext = sq->head;
+  sq->head = p;
+  release(&sq->lock);
 
   sched();
 
@@ -1048,24 +799,51 @@ void sleep(void *chan, struct spinlock *lk)
   acquire(lk);
 }
 
+// Unlink p from sq. sq->lock must be held.
+static void
+sqremove(struct sleepq *sq, struct proc *p)
+{
+  struct proc **pp;
+
+  for (pp = &sq->head; *pp; pp = &(*pp)->sqnext)
+  {
+    if (*pp == p)
+    {
+      *pp = p->sqnext;
+      p->sqnext = 0;
+      return;
+    }
+  }
+  panic("sqremove");
+}
+
 // Wake up all processes sleeping on chan.
 // Must be called without any p->lock.
 void wakeup(void *chan)
 {
-  struct proc *p;
+  struct sleepq *sq = SLEEPQ(chan);
+  struct proc *p, **pp;
 
-  for (p = proc; p < &proc[NPROC]; p++)
+  acquire(&sq->lock);
+  pp = &sq->head;
+  while ((p = *pp) != 0)
   {
-    if (p != myproc())
+    // p may not have reached sched() yet;
+    // acquiring p->lock waits for it.
+    acquire(&p->lock);
+    if (p->chan == chan)
     {
-      acquire(&p->lock);
-      if (p->state == SLEEPING && p->chan == chan)
-      {
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
+      *pp = p->sqnext;
+      p->sqnext = 0;
+      setrunnable(p);
     }
+    else
+    {
+      pp = &p->sqnext;
+    }
+    release(&p->lock);
   }
+  release(&sq->lock);
 }
 
 // Kill the process with the given pid.
@@ -1080,11 +858,29 @@ int kill(int pid)
     acquire(&p->lock);
     if (p->pid == pid)
     {
+      if (p->kfn)
+      {
+        release(&p->lock);
+        return -1;
+      }
       p->killed = 1;
-      if (p->state == SLEEPING)
+      // Wake process from sleep().
+      while (p->state == SLEEPING && p->pid == pid)
       {
-        // Wake process from sleep().
-        p->state = RUNNABLE;
+        // sq->lock comes before p->lock, so let go of p
+        // to lock its bucket, then check it is still
+        // asleep on the same channel.
+        void *chan = p->chan;
+        struct sleepq *sq = SLEEPQ(chan);
+        release(&p->lock);
+        acquire(&sq->lock);
+        acquire(&p->lock);
+        if (p->state == SLEEPING && p->chan == chan)
+        {
+          sqremove(sq, p);
+          setrunnable(p);
+        }
+        release(&sq->lock);
       }
       release(&p->lock);
       return 0;
@@ -1169,68 +965,27 @@ void procdump(void)
     else
       state = "???";
     printf("%s\n", state);
-#ifdef RR
-    printf("%d %s %s", p->pid, state, p->name);
-#endif
-#ifdef FCFS
-    printf("%d %s %s %d", p->pid, state, p->name, p->creationTime);
-#endif
-#ifdef PBS
-    int waitTime = ticks - p->creationTime - p->totalRunTime;
-    printf("%d %d %s %s %d %d %d", p->pid, nice_priority(p), state, p->name, p->totalRunTime, waitTime, p->numberOfRuns);
-#endif
-#ifdef MLFQ
-    int waitTime = ticks - p->queueCreationTime;
-    printf("%d %d %s %d %d %d %d %d %d %d %d", p->pid, p->priority, state, p->totalRunTime, waitTime, p->numberOfRuns, p->queueRunTime[0], p->queueRunTime[1], p->queueRunTime[2], p->queueRunTime[3], p->queueRunTime[4]);
-#endif
+    switch (p->policy)
+    {
+    case SCHED_FCFS:
+      printf("%d %s %s %d", p->pid, state, p->name, p->creationTime);
+      break;
+    case SCHED_PBS:
+    {
+      int waitTime = ticks - p->creationTime - p->totalRunTime;
+      printf("%d %d %s %s %d %d %d", p->pid, nice_priority(p), state, p->name, p->totalRunTime, waitTime, p->numberOfRuns);
+      break;
+    }
+    case SCHED_MLFQ:
+    {
+      int waitTime = ticks - p->queueCreationTime;
+      printf("%d %d %s %d %d %d %d %d %d %d %d", p->pid, p->currentQueue, state, p->totalRunTime, waitTime, p->numberOfRuns, p->queueRunTime[0], p->queueRunTime[1], p->queueRunTime[2], p->queueRunTime[3], p->queueRunTime[4]);
+      break;
+    }
+    default:
+      printf("%d %s %s", p->pid, state, p->name);
+      break;
+    }
     printf("\n");
   }
 }
-
-// find process at front of the queue
-struct proc *front(struct Queue *q)
-{
-  struct proc *retVal;
-  if (q->front == q->back)
-  {
-    return 0;
-  }
-  else
-  {
-    retVal = q->processes[q->front];
-  }
-  return retVal;
-}
-
-void pushQueue(struct Queue *q, struct proc *element)
-{
-  if (q->size == NPROC)
-  {
-    panic("Size Limit exceeded");
-  }
-
-  // add element to the back of the queue
-  q->processes[q->back] = element;
-  q->back++;
-  if (q->back == NPROC + 1)
-  {
-    q->back = 0;
-  }
-  q->size++;
-}
-
-void popQueue(struct Queue *q)
-{
-  if (q->size == 0)
-  {
-    panic("Queue is empty");
-  }
-
-  // pop element front the front of the queue
-  q->front++;
-  if (q->front == NPROC + 1)
-  {
-    q->front = 0;
-  }
-  q->size--;
-}
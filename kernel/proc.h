@@ -18,12 +18,38 @@ struct context {
   uint64 s11;
 };
 
+// A list of processes linked through p->rqnext and p->rqprev.
+struct plist {
+  struct proc *head;
+  struct proc *tail;
+};
+
+// Per-CPU queues of RUNNABLE processes, one set for each
+// scheduling class in sched.c.
+struct runq {
+  struct spinlock lock;
+  struct plist rr;            // RR: in arrival order
+  struct plist fcfs;          // FCFS: in creationTime order
+  struct proc *pbs[NPROC];    // PBS: min-heap, see sched.c
+  int npbs;
+  int lbs[NPROC + 1];          // LBS: Fenwick tree of tickets by proc slot
+  struct plist mlfq[MAXNUM];  // MLFQ: one list per level
+  uint mlfqmask;              // MLFQ: bit i set if mlfq[i] is not empty
+  int nq[NSCHED];             // Processes queued in each class
+  int n;                      // Processes queued here in all
+};
+
 // Per-CPU state.
 struct cpu {
   struct proc *proc;          // The process running on this cpu, or null.
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  int online;                 // Has entered scheduler()?
+  struct runq rq;             // Processes waiting to run on this cpu
+  uint balanced;              // ticks at the last load balance
+  int idle;                   // Waiting in wfi for work; see sched_idle()
+  int resched;                // Preempt the current process; see sched_ipi()
 };
 
 extern struct cpu cpus[NCPU];
@@ -81,12 +107,25 @@ struct trapframe {
 
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
-struct Queue
-{
-  int front;
-  int back;
-  int size;
-  struct proc *processes[NPROC + 1];
+// A loadable segment of a process's executable. exec()
+// records it, and vmfault() reads its pages from the
+// file the first time they are touched.
+#define NSEG 4
+struct segment {
+  uint64 va;      // page-aligned start address
+  uint64 memsz;   // bytes of memory in the segment
+  uint off;       // file offset of va
+  uint filesz;    // bytes backed by the file; the rest is zero
+  int perm;       // PTE_W and PTE_X as the ELF flags ask
+};
+
+// A timer on a hart's timer wheel; see timer.c.
+struct timer {
+  uint64 expires;       // wheel time unit it is due at
+  struct timer *next;   // Next timer in the same wheel slot
+  struct timer *prev;   // Previous timer in that slot
+  int level, slot;      // which slot
+  int cpu;              // hart whose wheel holds it, or -1
 };
 
 // Per-process state
@@ -100,6 +139,9 @@ struct proc {
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
 
+  // the sleep queue's lock must be held when using this:
+  struct proc *sqnext;         // Next process sleeping in the same bucket
+
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
 
@@ -111,7 +153,11 @@ struct proc {
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct inode *exe;           // Executable, for demand paging
+  int nseg;                    // Number of segments of exe
+  struct segment seg[NSEG];    // Loadable segments of exe
   char name[16];               // Process name (debugging)
+  void (*kfn)(void);           // Kernel thread's function, or 0
 
   // enhancing xv-6
 
@@ -124,21 +170,35 @@ struct proc {
   uint64 alarm_handler;   // pointer to the alarm handler function
   struct trapframe etpfm; // trapframe to resume the process
 
+  // sleep timer (timer.c), protected by its wheel's lock
+  struct timer timer;
+
+  // run queues (sched.c)
+  struct proc *rqnext;         // Next process on the same run queue list
+  struct proc *rqprev;         // Previous process on that list
+  int rqcpu;                   // cpu whose rq holds this process, or -1
+  int lastcpu;                 // cpu this process last ran on, or -1
+
   // scheduling - FCFS
   int creationTime;                  // Time added to proc list
   int totalRunTime;                  // Total run time
   int exitTime;                 // Time when proc should be removed
-  int priority;                 // for PBS - priority of process and for MLFQ - current quene number
+  int policy;                   // Scheduling class, SCHED_* in sched.h
+  int priority;                 // for PBS - static priority of process
   // scheduling - LBS
   int tickets;
 
   // scheduling - PBS
   int numberOfRuns;            // Number of times the process has been scheduled
-  int runTime;                 // Time spent running
-  int waitTime;                   // Time spent waiting
+  int runTime;                 // Time spent running since last scheduled
+  int waitTime;                // Time spent sleeping since last scheduled
+  int lastScheduled;           // ticks when last switched to or charged
+  int lastSlept;               // ticks when last went to sleep
+  int dp;                      // Dynamic priority, while queued
+  int heapIndex;               // Position in the run queue's PBS heap
 
   // scheduling - MLFQ
-  int checkQueue;              
+  int currentQueue;            // current queue number
   int timeQuantum;
   int queueCreationTime;
   int queueRunTime[MAXNUM];
@@ -0,0 +1,931 @@
+// Scheduling classes.
+//
+// Every process belongs to one of the classes in classes[],
+// chosen by p->policy (see sched.h). A class decides the
+// order in which its RUNNABLE processes run, and whether a
+// running process is preempted at a timer tick. setsched()
+// moves one process, or all of them, to another class while
+// the system runs; scheduler() asks the default class,
+// schedpolicy, for a process first and then the others in
+// table order.
+//
+// Each cpu has its own run queues, one set per class, in
+// cpu->rq. Every RUNNABLE process waits on the queues of
+// exactly one cpu, and p->rqcpu says which; p->rqcpu only
+// changes with that cpu's rq.lock held. A process that
+// yields stays on its cpu; one that wakes up or is forked
+// goes to the least-loaded cpu, preferring the one it last
+// ran on. A cpu with nothing to run steals half of the
+// busiest cpu's processes, and every BALANCEINT ticks each
+// cpu pulls work from the busiest one if it is two or more
+// ahead. A cpu with nothing to run or steal waits in wfi
+// until setrunnable() sends it an IPI. A process that
+// wakes up, or is given a better priority, ahead of what
+// some cpu is running is queued there, and that cpu gets
+// an IPI to preempt at once rather than at its next tick.
+//
+// While p is queued, its scheduling fields are protected
+// by the queue's rq.lock.
+//
+// lock order: p->lock, then rq locks in cpus[] order.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sched.h"
+#include "defs.h"
+
+extern struct proc proc[NPROC];
+extern long random_gen(long);
+
+struct sched_class
+{
+  char *name;
+  // add RUNNABLE p to rq.
+  void (*enqueue)(struct runq *rq, struct proc *p);
+  // remove p, which is queued, from rq.
+  void (*dequeue)(struct runq *rq, struct proc *p);
+  // remove and return the process to run next, or 0.
+  struct proc *(*pick_next)(struct runq *rq);
+  // p has run for a tick; return 1 to preempt it.
+  int (*tick)(struct proc *p);
+  // return 1 if p, just queued, should preempt curr, which
+  // is running in the same class. 0 if it never should.
+  int (*preempt)(struct proc *p, struct proc *curr);
+};
+
+static struct sched_class classes[NSCHED];
+
+// the policy the kernel boots with, chosen by
+// make SCHEDULER=...
+#if defined FCFS
+int schedpolicy = SCHED_FCFS;
+#elif defined PBS
+int schedpolicy = SCHED_PBS;
+#elif defined LBS
+int schedpolicy = SCHED_LBS;
+#elif defined MLFQ
+int schedpolicy = SCHED_MLFQ;
+#else
+int schedpolicy = SCHED_RR;
+#endif
+
+void sched_init(void)
+{
+  struct cpu *c;
+
+  for (c = cpus; c < &cpus[NCPU]; c++)
+    initlock(&c->rq.lock, "runq");
+}
+
+char *
+schedname(int policy)
+{
+  if (policy < 0 || policy >= NSCHED)
+    return "???";
+  return classes[policy].name;
+}
+
+// Lists of processes linked through p->rqnext and
+// p->rqprev.
+
+// Put p on l just before q, or at the end if q is 0.
+static void
+pl_insert(struct plist *l, struct proc *q, struct proc *p)
+{
+  p->rqnext = q;
+  p->rqprev = q ? q->rqprev : l->tail;
+  if (p->rqprev)
+    p->rqprev->rqnext = p;
+  else
+    l->head = p;
+  if (q)
+    q->rqprev = p;
+  else
+    l->tail = p;
+}
+
+static void
+pl_append(struct plist *l, struct proc *p)
+{
+  pl_insert(l, 0, p);
+}
+
+static void
+pl_remove(struct plist *l, struct proc *p)
+{
+  if (p->rqprev)
+    p->rqprev->rqnext = p->rqnext;
+  else
+    l->head = p->rqnext;
+  if (p->rqnext)
+    p->rqnext->rqprev = p->rqprev;
+  else
+    l->tail = p->rqprev;
+  p->rqnext = 0;
+  p->rqprev = 0;
+}
+
+static struct proc *
+pl_pop(struct plist *l)
+{
+  struct proc *p = l->head;
+
+  if (p)
+    pl_remove(l, p);
+  return p;
+}
+
+// RR: run in arrival order, a tick at a time.
+
+static void
+rr_enqueue(struct runq *rq, struct proc *p)
+{
+  pl_append(&rq->rr, p);
+}
+
+static void
+rr_dequeue(struct runq *rq, struct proc *p)
+{
+  pl_remove(&rq->rr, p);
+}
+
+static struct proc *
+rr_pick_next(struct runq *rq)
+{
+  return pl_pop(&rq->rr);
+}
+
+static int
+rr_tick(struct proc *p)
+{
+  return 1;
+}
+
+// FCFS: run the earliest created process until it blocks.
+
+static void
+fcfs_enqueue(struct runq *rq, struct proc *p)
+{
+  struct proc *q;
+
+  // keep the list in creationTime order.
+  for (q = rq->fcfs.head; q; q = q->rqnext)
+  {
+    if (q->creationTime > p->creationTime)
+      break;
+  }
+  pl_insert(&rq->fcfs, q, p);
+}
+
+static void
+fcfs_dequeue(struct runq *rq, struct proc *p)
+{
+  pl_remove(&rq->fcfs, p);
+}
+
+static struct proc *
+fcfs_pick_next(struct runq *rq)
+{
+  return pl_pop(&rq->fcfs);
+}
+
+static int
+fcfs_tick(struct proc *p)
+{
+  return 0;
+}
+
+// PBS: run the process with the best dynamic priority until
+// it blocks; ties go to the one scheduled fewer times, then
+// to the earliest created. runTime and waitTime cover the
+// time since the process was last scheduled, and are kept
+// up to date by scheduler(), sleep() and setrunnable().
+
+static int
+check(struct proc *p)
+{
+  if (p->runTime + p->waitTime == 0)
+  {
+    return 0;
+  }
+  else
+  {
+    return 1;
+  }
+}
+
+// dynamic priority of p: its static priority, adjusted
+// by how much of its recent time it spent sleeping.
+int nice_priority(struct proc *p)
+{
+  int niceness, dp;
+  int x = check(p);
+  if (x == 0)
+  {
+    niceness = 5;
+  }
+  else
+  {
+    niceness = p->waitTime * 10;
+    niceness /= (p->runTime + p->waitTime);
+  }
+  dp = p->priority - niceness + 5;
+  if (dp < 0)
+  {
+    dp = 0;
+  }
+  int retVal;
+  if (dp > 100)
+  {
+    retVal = 100;
+  }
+  else
+  {
+    retVal = dp;
+  }
+  return retVal;
+}
+
+// rq->pbs is a binary min-heap ordered by pbs_before(),
+// with each process's index in p->heapIndex so that it can
+// be removed or moved in place. The dynamic priority of a
+// queued process cannot change by itself, since it is
+// neither running nor sleeping, so it is computed once, in
+// p->dp, when the process is queued, and again only if
+// set_priority() changes it.
+
+static int
+pbs_before(struct proc *a, struct proc *b)
+{
+  if (a->dp != b->dp)
+    return a->dp < b->dp;
+  if (a->numberOfRuns != b->numberOfRuns)
+    return a->numberOfRuns < b->numberOfRuns;
+  return a->creationTime < b->creationTime;
+}
+
+static void
+pbs_set(struct runq *rq, int i, struct proc *p)
+{
+  rq->pbs[i] = p;
+  p->heapIndex = i;
+}
+
+static void
+pbs_up(struct runq *rq, int i)
+{
+  struct proc *p = rq->pbs[i];
+
+  while (i > 0 && pbs_before(p, rq->pbs[(i - 1) / 2]))
+  {
+    pbs_set(rq, i, rq->pbs[(i - 1) / 2]);
+    i = (i - 1) / 2;
+  }
+  pbs_set(rq, i, p);
+}
+
+static void
+pbs_down(struct runq *rq, int i)
+{
+  struct proc *p = rq->pbs[i];
+  int child;
+
+  for (;;)
+  {
+    child = 2 * i + 1;
+    if (child >= rq->npbs)
+      break;
+    if (child + 1 < rq->npbs && pbs_before(rq->pbs[child + 1], rq->pbs[child]))
+      child++;
+    if (!pbs_before(rq->pbs[child], p))
+      break;
+    pbs_set(rq, i, rq->pbs[child]);
+    i = child;
+  }
+  pbs_set(rq, i, p);
+}
+
+static void
+pbs_enqueue(struct runq *rq, struct proc *p)
+{
+  p->dp = nice_priority(p);
+  pbs_set(rq, rq->npbs++, p);
+  pbs_up(rq, p->heapIndex);
+}
+
+static void
+pbs_dequeue(struct runq *rq, struct proc *p)
+{
+  struct proc *last = rq->pbs[--rq->npbs];
+  int i = p->heapIndex;
+
+  if (last != p)
+  {
+    pbs_set(rq, i, last);
+    pbs_up(rq, i);
+    pbs_down(rq, last->heapIndex);
+  }
+}
+
+static struct proc *
+pbs_pick_next(struct runq *rq)
+{
+  struct proc *p;
+
+  if (rq->npbs == 0)
+    return 0;
+  p = rq->pbs[0];
+  pbs_dequeue(rq, p);
+  return p;
+}
+
+static int
+pbs_tick(struct proc *p)
+{
+  return 0;
+}
+
+static int
+pbs_preempt(struct proc *p, struct proc *curr)
+{
+  return pbs_before(p, curr);
+}
+
+// LBS: hold a lottery among the queued processes, each
+// holding p->tickets tickets; run the winner for a tick.
+// rq->lbs is a Fenwick tree over proc[] slots: entry i
+// holds the tickets of the queued processes in slots
+// (i - (i & -i), i], so that both updating one process
+// and finding the holder of a ticket take O(log NPROC).
+
+// Add n tickets to proc slot i.
+static void
+lbs_add(int *tree, int i, int n)
+{
+  for (i++; i <= NPROC; i += i & -i)
+    tree[i] += n;
+}
+
+// Total tickets of the queued processes.
+static int
+lbs_total(int *tree)
+{
+  int i, total = 0;
+
+  for (i = NPROC; i > 0; i -= i & -i)
+    total += tree[i];
+  return total;
+}
+
+// The slot of the process holding ticket t, counting
+// from 0 across slots in order.
+static int
+lbs_find(int *tree, int t)
+{
+  int step, pos = 0;
+
+  for (step = 1; step * 2 <= NPROC; step *= 2)
+    ;
+  for (; step > 0; step /= 2)
+  {
+    if (pos + step <= NPROC && tree[pos + step] <= t)
+    {
+      pos += step;
+      t -= tree[pos];
+    }
+  }
+  return pos;
+}
+
+static void
+lbs_enqueue(struct runq *rq, struct proc *p)
+{
+  lbs_add(rq->lbs, p - proc, p->tickets);
+}
+
+static void
+lbs_dequeue(struct runq *rq, struct proc *p)
+{
+  lbs_add(rq->lbs, p - proc, -p->tickets);
+}
+
+static struct proc *
+lbs_pick_next(struct runq *rq)
+{
+  struct proc *p;
+  int total;
+
+  // every process holds at least one ticket.
+  total = lbs_total(rq->lbs);
+  if (total == 0)
+    return 0;
+  p = &proc[lbs_find(rq->lbs, random_gen(total - 1))];
+  lbs_dequeue(rq, p);
+  return p;
+}
+
+static int
+lbs_tick(struct proc *p)
+{
+  return 1;
+}
+
+// MLFQ: run the first process of the highest non-empty
+// level for its level's time quantum; one that uses up its
+// quantum drops a level, and one that has waited AGINGNUM
+// ticks rises a level. rq->mlfqmask has bit i set when
+// level i has processes, so finding the highest is a
+// find-first-set, and each level is a list in the order
+// the processes started waiting at it, so only the first
+// of each can be due for aging.
+
+// Index of the lowest set bit of x, which must not be 0.
+static int
+lowbit(uint x)
+{
+  static const char debruijn[32] = {
+    0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+    31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9,
+  };
+
+  return debruijn[((x & -x) * 0x077CB531U) >> 27];
+}
+
+static void
+mlfq_enqueue(struct runq *rq, struct proc *p)
+{
+  struct plist *l = &rq->mlfq[p->currentQueue];
+  struct proc *q;
+
+  // usually p goes last, but one moved from another cpu
+  // keeps its place by waiting time.
+  for (q = l->tail; q && q->queueCreationTime > p->queueCreationTime; q = q->rqprev)
+    ;
+  pl_insert(l, q ? q->rqnext : l->head, p);
+  rq->mlfqmask |= 1 << p->currentQueue;
+}
+
+static void
+mlfq_dequeue(struct runq *rq, struct proc *p)
+{
+  pl_remove(&rq->mlfq[p->currentQueue], p);
+  if (rq->mlfq[p->currentQueue].head == 0)
+    rq->mlfqmask &= ~(1 << p->currentQueue);
+}
+
+static struct proc *
+mlfq_pick_next(struct runq *rq)
+{
+  struct proc *p;
+  int level;
+
+  // Implement Aging
+  for (level = 1; level < MAXNUM; level++)
+  {
+    while ((p = rq->mlfq[level].head) != 0 &&
+           ticks - p->queueCreationTime >= AGINGNUM)
+    {
+      mlfq_dequeue(rq, p);
+      p->currentQueue--;
+      p->queueCreationTime = ticks;
+      mlfq_enqueue(rq, p);
+    }
+  }
+
+  if (rq->mlfqmask == 0)
+    return 0;
+  p = rq->mlfq[lowbit(rq->mlfqmask)].head;
+  mlfq_dequeue(rq, p);
+  p->timeQuantum = p->currentQueue * 2;
+  return p;
+}
+
+static int
+mlfq_tick(struct proc *p)
+{
+  int higher, expired;
+
+  acquire(&p->lock);
+  p->timeQuantum -= account(p);
+  expired = p->timeQuantum <= 0;
+  if (expired && p->currentQueue + 1 != MAXNUM)
+    p->currentQueue++;
+  release(&p->lock);
+  if (expired)
+    return 1;
+
+  // give way to a process queued here at a higher level.
+  push_off();
+  higher = (mycpu()->rq.mlfqmask & ((1 << p->currentQueue) - 1)) != 0;
+  pop_off();
+  return higher;
+}
+
+static int
+mlfq_preempt(struct proc *p, struct proc *curr)
+{
+  return p->currentQueue < curr->currentQueue;
+}
+
+static struct sched_class classes[NSCHED] = {
+[SCHED_RR]   { "RR",   rr_enqueue,   rr_dequeue,   rr_pick_next,   rr_tick,   0 },
+[SCHED_FCFS] { "FCFS", fcfs_enqueue, fcfs_dequeue, fcfs_pick_next, fcfs_tick, 0 },
+[SCHED_PBS]  { "PBS",  pbs_enqueue,  pbs_dequeue,  pbs_pick_next,  pbs_tick,  pbs_preempt },
+[SCHED_LBS]  { "LBS",  lbs_enqueue,  lbs_dequeue,  lbs_pick_next,  lbs_tick,  0 },
+[SCHED_MLFQ] { "MLFQ", mlfq_enqueue, mlfq_dequeue, mlfq_pick_next, mlfq_tick, mlfq_preempt },
+};
+
+// Add p to c's queues. c->rq.lock must be held.
+static void
+rqadd(struct cpu *c, struct proc *p)
+{
+  classes[p->policy].enqueue(&c->rq, p);
+  c->rq.nq[p->policy]++;
+  c->rq.n++;
+  p->rqcpu = c - cpus;
+}
+
+// Remove p from c's queues. c->rq.lock must be held.
+static void
+rqdel(struct cpu *c, struct proc *p)
+{
+  classes[p->policy].dequeue(&c->rq, p);
+  c->rq.nq[p->policy]--;
+  c->rq.n--;
+  p->rqcpu = -1;
+}
+
+// Remove and return the process c should run next,
+// or 0 if its queues are empty. c->rq.lock must be held.
+static struct proc *
+rqtake(struct cpu *c)
+{
+  struct proc *p;
+  int i, k;
+
+  // the default class first, then the rest in order.
+  for (i = -1; i < NSCHED; i++)
+  {
+    k = i < 0 ? schedpolicy : i;
+    if (i == schedpolicy || c->rq.nq[k] == 0)
+      continue;
+    if ((p = classes[k].pick_next(&c->rq)) != 0)
+    {
+      c->rq.nq[k]--;
+      c->rq.n--;
+      p->rqcpu = -1;
+      return p;
+    }
+  }
+  return 0;
+}
+
+// Lock and return the cpu whose queues hold p, or
+// return 0 if p is on none. p->lock must be held.
+static struct cpu *
+rqlock(struct proc *p)
+{
+  int id;
+
+  for (;;)
+  {
+    id = p->rqcpu;
+    if (id < 0)
+      return 0;
+    acquire(&cpus[id].rq.lock);
+    if (p->rqcpu == id)
+      return &cpus[id];
+    // stolen meanwhile; chase it.
+    release(&cpus[id].rq.lock);
+  }
+}
+
+// Move up to n processes from from's queues to to's.
+static void
+rqmove(struct cpu *to, struct cpu *from, int n)
+{
+  struct cpu *first = to < from ? to : from;
+  struct cpu *second = to < from ? from : to;
+  struct proc *p;
+
+  acquire(&first->rq.lock);
+  acquire(&second->rq.lock);
+  for (; n > 0 && (p = rqtake(from)) != 0; n--)
+    rqadd(to, p);
+  release(&second->rq.lock);
+  release(&first->rq.lock);
+}
+
+// The online cpu other than c with the most queued
+// processes, or 0. The counts are read without locks,
+// so this is only a hint.
+static struct cpu *
+rqbusiest(struct cpu *c)
+{
+  struct cpu *v, *busiest = 0;
+
+  for (v = cpus; v < &cpus[NCPU]; v++)
+  {
+    if (v == c || !v->online)
+      continue;
+    if (busiest == 0 || v->rq.n > busiest->rq.n)
+      busiest = v;
+  }
+  return busiest;
+}
+
+// Choose the cpu whose queues p should join.
+static struct cpu *
+rqpick(struct proc *p)
+{
+  struct cpu *c, *best = 0;
+
+  // a yielding process is still cache-warm here.
+  if (p->state == RUNNING)
+    return mycpu();
+
+  if (p->lastcpu >= 0 && cpus[p->lastcpu].online)
+    best = &cpus[p->lastcpu];
+  for (c = cpus; c < &cpus[NCPU]; c++)
+  {
+    if (c->online && (best == 0 || c->rq.n < best->rq.n))
+      best = c;
+  }
+  // nothing is scheduling yet, e.g. userinit().
+  return best ? best : mycpu();
+}
+
+// Whether p, which is queued, should preempt the process
+// c is running. c->proc is read without locks, so this is
+// only a hint.
+static int
+preempts(struct proc *p, struct cpu *c)
+{
+  struct proc *curr = c->proc;
+  struct sched_class *k = &classes[p->policy];
+
+  if (curr == 0 || curr == p)
+    return 0;
+  // as in sched_tick(), the default class comes first.
+  if (curr->policy != p->policy)
+    return p->policy == schedpolicy;
+  return k->preempt != 0 && k->preempt(p, curr);
+}
+
+// Ask c to preempt its process now rather than at its
+// next tick; see sched_ipi().
+static void
+resched(struct cpu *c)
+{
+  c->resched = 1;
+  sendipi(c - cpus);
+}
+
+// Mark p RUNNABLE and queue it on some cpu. Every
+// transition to RUNNABLE goes through here.
+// p->lock must be held.
+void setrunnable(struct proc *p)
+{
+  struct cpu *c = rqpick(p), *v;
+  int yielding = p->state == RUNNING;
+
+  if (p->state == SLEEPING)
+    p->waitTime += ticks - p->lastSlept;
+  p->state = RUNNABLE;
+  // MLFQ aging counts from here, and not from moves
+  // between cpus' queues.
+  p->queueCreationTime = ticks;
+
+  // with no cpu idle, prefer one whose process p beats.
+  if (!yielding && !c->idle && !preempts(p, c))
+  {
+    for (v = cpus; v < &cpus[NCPU]; v++)
+    {
+      if (v->online && preempts(p, v))
+      {
+        c = v;
+        break;
+      }
+    }
+  }
+
+  acquire(&c->rq.lock);
+  rqadd(c, p);
+  release(&c->rq.lock);
+
+  // wake c if it is idle, and interrupt it if p should
+  // run right away. otherwise p has to wait, so wake an
+  // idle cpu to steal it; a yielding p only waits if
+  // others are queued ahead of it.
+  if (c->idle)
+  {
+    sendipi(c - cpus);
+  }
+  else if (!yielding && preempts(p, c))
+  {
+    resched(c);
+  }
+  else if (!yielding || c->rq.n > 1)
+  {
+    for (v = cpus; v < &cpus[NCPU]; v++)
+    {
+      if (v->online && v->idle)
+      {
+        sendipi(v - cpus);
+        break;
+      }
+    }
+  }
+}
+
+// Return the next process for c to run, taken off the
+// queues, balancing or stealing first as needed; or 0
+// if there is nothing to run anywhere.
+struct proc *
+sched_next(struct cpu *c)
+{
+  struct cpu *v;
+  struct proc *p;
+
+  if (ticks - c->balanced >= BALANCEINT)
+  {
+    c->balanced = ticks;
+    v = rqbusiest(c);
+    if (v && v->rq.n - c->rq.n >= 2)
+      rqmove(c, v, (v->rq.n - c->rq.n) / 2);
+  }
+
+  acquire(&c->rq.lock);
+  p = rqtake(c);
+  release(&c->rq.lock);
+  if (p)
+    return p;
+
+  v = rqbusiest(c);
+  if (v == 0 || v->rq.n == 0)
+    return 0;
+  rqmove(c, v, (v->rq.n + 1) / 2);
+  acquire(&c->rq.lock);
+  p = rqtake(c);
+  release(&c->rq.lock);
+  return p;
+}
+
+// Called by scheduler() when sched_next() found nothing:
+// wait in wfi for an interrupt. The hart skips its ticks
+// while it waits, so it sleeps until an IPI, a device
+// interrupt, or one of its timers.
+void sched_idle(struct cpu *c)
+{
+  struct cpu *v;
+
+  intr_off();
+  c->idle = 1;
+  // setrunnable() queues before it looks at idle, and
+  // this looks at the queues after setting it, so either
+  // the work is seen here or an IPI is on its way.
+  __sync_synchronize();
+  for (v = cpus; v < &cpus[NCPU]; v++)
+  {
+    if (v->online && v->rq.n > 0)
+      break;
+  }
+  if (v == &cpus[NCPU])
+  {
+    timeridle(1);
+    // wakes for a pending interrupt even with them
+    // disabled; scheduler()'s intr_on() then takes it.
+    asm volatile("wfi");
+    timeridle(0);
+  }
+  c->idle = 0;
+}
+
+// Called at each timer interrupt while p is running.
+// Returns 1 if p should yield the cpu.
+int sched_tick(struct proc *p)
+{
+  struct cpu *c;
+  int preempt;
+
+  preempt = classes[p->policy].tick(p);
+
+  // a process outside the default class gives way
+  // to any queued here that are in it.
+  push_off();
+  c = mycpu();
+  if (p->policy != schedpolicy && c->rq.nq[schedpolicy] != 0)
+    preempt = 1;
+  pop_off();
+  return preempt;
+}
+
+// Called when an IPI arrives. Returns 1 if it asked this
+// cpu to preempt its process.
+int sched_ipi(void)
+{
+  int r;
+
+  push_off();
+  r = __sync_lock_test_and_set(&mycpu()->resched, 0);
+  pop_off();
+  return r;
+}
+
+// Give p n lottery tickets, updating its run queue's
+// ticket tree if it is waiting there.
+void sched_settickets(struct proc *p, int n)
+{
+  struct cpu *c;
+
+  acquire(&p->lock);
+  if (p->state == RUNNABLE && (c = rqlock(p)) != 0)
+  {
+    if (p->policy == SCHED_LBS)
+      lbs_add(c->rq.lbs, p - proc, n - p->tickets);
+    p->tickets = n;
+    release(&c->rq.lock);
+  }
+  else
+  {
+    p->tickets = n;
+  }
+  release(&p->lock);
+}
+
+// p's static priority or run time has changed; if it is
+// queued under PBS, move it to its new place in the heap.
+// p->lock must be held.
+void sched_reprioritize(struct proc *p)
+{
+  struct cpu *c;
+  int old;
+
+  if (p->state != RUNNABLE || p->policy != SCHED_PBS || (c = rqlock(p)) == 0)
+    return;
+  old = p->dp;
+  p->dp = nice_priority(p);
+  if (p->dp < old)
+    pbs_up(&c->rq, p->heapIndex);
+  else
+    pbs_down(&c->rq, p->heapIndex);
+  if (preempts(p, c))
+    resched(c);
+  release(&c->rq.lock);
+}
+
+// Move p to class policy, requeueing it if it is waiting
+// to run. p->lock must be held.
+static void
+schedmove(struct proc *p, int policy)
+{
+  struct cpu *c;
+
+  if (p->policy == policy)
+    return;
+  if (p->state == RUNNABLE && (c = rqlock(p)) != 0)
+  {
+    rqdel(c, p);
+    p->policy = policy;
+    rqadd(c, p);
+    release(&c->rq.lock);
+  }
+  else
+  {
+    p->policy = policy;
+  }
+}
+
+// Move process pid to scheduling class policy; if pid is
+// 0, move every process and make policy the default.
+// Returns the previous policy of pid, or the previous
+// default, or -1 if there is no such policy or process.
+int setsched(int policy, int pid)
+{
+  struct proc *p;
+  int old = -1;
+
+  if (policy < 0 || policy >= NSCHED)
+    return -1;
+  if (pid == 0)
+  {
+    old = schedpolicy;
+    schedpolicy = policy;
+  }
+  for (p = proc; p < &proc[NPROC]; p++)
+  {
+    acquire(&p->lock);
+    if (p->state != UNUSED && (pid == 0 || p->pid == pid))
+    {
+      if (pid != 0)
+        old = p->policy;
+      schedmove(p, policy);
+    }
+    release(&p->lock);
+  }
+  return old;
+}
@@ -0,0 +1,6 @@
+// Scheduling policies, for setsched().
+#define SCHED_RR    0  // round robin
+#define SCHED_FCFS  1  // first come, first served
+#define SCHED_PBS   2  // priority based
+#define SCHED_LBS   3  // lottery
+#define SCHED_MLFQ  4  // multi-level feedback queue
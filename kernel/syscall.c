@@ -111,6 +111,8 @@ extern uint64 sys_sigreturn(void);
 extern uint64 sys_waitx(void);
 extern uint64 sys_set_priority(void);
 extern uint64 sys_settickets(void);
+extern uint64 sys_setsched(void);
+extern uint64 sys_nsleep(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -144,6 +146,8 @@ static uint64 (*syscalls[])(void) = {
 [SYS_waitx]         sys_waitx,
 [SYS_set_priority]  sys_set_priority,
 [SYS_settickets]    sys_settickets,
+[SYS_setsched]      sys_setsched,
+[SYS_nsleep]        sys_nsleep,
 };
 
 // enhancing xv-6
@@ -203,6 +207,10 @@ struct syscall_info syscall_infos[] = {
     { 1, "set_priority" },
     [SYS_settickets]
     { 1, "settickets" },
+    [SYS_setsched]
+    { 2, "setsched" },
+    [SYS_nsleep]
+    { 1, "nsleep" },
 };
 
 void
@@ -27,4 +27,6 @@
 #define SYS_sigreturn    24
 #define SYS_waitx        25
 #define SYS_set_priority 26
-#define SYS_settickets   27
\ No newline at end of file
+#define SYS_settickets   27
+#define SYS_setsched     28
+#define SYS_nsleep       29
\ No newline at end of file
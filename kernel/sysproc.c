@@ -52,20 +52,22 @@ uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   argint(0, &n);
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(killed(myproc())){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  if(n < 0)
+    n = 0;
+  return timersleep((uint64)n * TICKINTERVAL);
+}
+
+// Sleep for a number of nanoseconds, to the resolution
+// of the CLINT timer.
+uint64
+sys_nsleep(void)
+{
+  uint64 ns;
+
+  argaddr(0, &ns);
+  return timersleep(ns / (1000000000 / CLINT_FREQ));
 }
 
 uint64
@@ -82,12 +84,7 @@ sys_kill(void)
 uint64
 sys_uptime(void)
 {
-  uint xticks;
-
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
-  return xticks;
+  return ticks;
 }
 
 // enhancing xv-6
@@ -154,9 +151,6 @@ sys_waitx(void)
 uint64
 sys_set_priority(void)
 {
-#ifndef PBS
-  return -1;
-#endif
   int priority, pid;
   int old = -1;
   argint(0, &priority);
@@ -171,6 +165,21 @@ sys_settickets(void)
   int n;
   if (argint(0, &n) < 0)
     return -1;
-  myproc()->tickets = n;
+  if (n < 1)
+    return -1;
+  sched_settickets(myproc(), n);
   return n;
-}
\ No newline at end of file
+}
+
+// Switch process pid, or all processes if pid is 0,
+// to a scheduling policy from sched.h.
+uint64
+sys_setsched(void)
+{
+  int policy, pid;
+  if (argint(0, &policy) < 0)
+    return -1;
+  if (argint(1, &pid) < 0)
+    return -1;
+  return setsched(policy, pid);
+}
@@ -0,0 +1,309 @@
+// Timers.
+//
+// Each hart keeps a hierarchical timer wheel of the timers
+// armed on it, and programs its CLINT mtimecmp for the
+// earlier of its next tick and the next time the wheel has
+// work, so a timer fires when it is due rather than at the
+// next tick. timervec in kernelvec.S only disarms mtimecmp
+// and passes the interrupt on to devintr(), which calls
+// timerintr().
+//
+// Time on a wheel counts in units of 1<<TWSHIFT cycles.
+// Level l has TWSLOTS slots, each a list of the timers due
+// in one span of TWSLOTS^l units, so a timer goes in the
+// lowest level whose slots reach its expiry. When the wheel
+// clock reaches the start of a span of a higher level, that
+// span's slot is poured down into the levels below, and
+// the level-0 slot for the current unit holds exactly the
+// timers due now. w->mask[l] has bit i set if slot i of
+// level l is non-empty, so empty stretches of time are
+// skipped rather than stepped through.
+//
+// A process sleeps in timersleep() on its own p->timer,
+// and only that timer's expiry, or timerwake(), wakes it.
+//
+// lock order: wheel lock, then sleepq and p->lock.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define TWSHIFT   4                 // cycles per wheel unit, log 2
+#define TWBITS    6
+#define TWSLOTS   (1 << TWBITS)     // slots per level
+#define TWLEVELS  5                 // reaches 1<<34 cycles, about half an hour
+#define TWSPAN(l) (1ULL << (TWBITS * (l))) // units per slot of level l
+
+#define MTIME() (*(uint64 *)CLINT_MTIME)
+
+struct wheel
+{
+  struct spinlock lock;
+  uint64 clk;                               // first unit not yet run
+  uint64 mask[TWLEVELS];                    // non-empty slots
+  struct timer *slot[TWLEVELS][TWSLOTS];
+  uint64 nexttick;                          // cycle of this hart's next tick
+  int idle;                                 // hart is idle; skip ticks
+} wheels[NCPU];
+
+void timerwheelinit(void)
+{
+  struct wheel *w;
+  uint64 now = MTIME();
+
+  for (w = wheels; w < &wheels[NCPU]; w++)
+  {
+    initlock(&w->lock, "wheel");
+    w->clk = now >> TWSHIFT;
+    w->nexttick = now + TICKINTERVAL;
+  }
+}
+
+// Index of the lowest set bit of x, which must not be 0.
+static int
+lowbit64(uint64 x)
+{
+  static const char debruijn[64] = {
+    0, 1, 48, 2, 57, 49, 28, 3, 61, 58, 50, 42, 38, 29, 17, 4,
+    62, 55, 59, 36, 53, 51, 43, 22, 45, 39, 33, 30, 24, 18, 12, 5,
+    63, 47, 56, 27, 60, 41, 37, 16, 54, 35, 52, 21, 44, 32, 23, 11,
+    46, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19, 9, 13, 8, 7, 6,
+  };
+
+  return debruijn[((x & -x) * 0x03f79d71b4cb0a89ULL) >> 58];
+}
+
+// Put t on w, in the lowest level that reaches t->expires.
+// w->lock must be held.
+static void
+twadd(struct wheel *w, struct timer *t)
+{
+  uint64 at = t->expires < w->clk ? w->clk : t->expires;
+  int l, i;
+
+  for (l = 0; l < TWLEVELS - 1 && at - w->clk >= TWSPAN(l + 1); l++)
+    ;
+  // beyond the top level: park t in its last slot, to be
+  // poured down and placed again when that comes round.
+  if (at - w->clk >= TWSPAN(TWLEVELS))
+    at = w->clk + TWSPAN(TWLEVELS) - 1;
+  i = (at >> (TWBITS * l)) & (TWSLOTS - 1);
+
+  t->level = l;
+  t->slot = i;
+  t->cpu = w - wheels;
+  t->prev = 0;
+  t->next = w->slot[l][i];
+  if (t->next)
+    t->next->prev = t;
+  w->slot[l][i] = t;
+  w->mask[l] |= 1ULL << i;
+}
+
+// Take t, which is on w, off it. w->lock must be held.
+static void
+twdel(struct wheel *w, struct timer *t)
+{
+  if (t->prev)
+    t->prev->next = t->next;
+  else
+    w->slot[t->level][t->slot] = t->next;
+  if (t->next)
+    t->next->prev = t->prev;
+  if (w->slot[t->level][t->slot] == 0)
+    w->mask[t->level] &= ~(1ULL << t->slot);
+  t->next = t->prev = 0;
+  t->cpu = -1;
+}
+
+// The first unit at or after w->clk at which w has work:
+// a level-0 slot to run or a higher slot to pour down.
+// Returns ~0 if w is empty. w->lock must be held.
+static uint64
+twnext(struct wheel *w)
+{
+  uint64 m, at, next = ~0ULL;
+  int l, i, d, shift;
+
+  for (l = 0; l < TWLEVELS; l++)
+  {
+    if (w->mask[l] == 0)
+      continue;
+    shift = TWBITS * l;
+    i = (w->clk >> shift) & (TWSLOTS - 1);
+    // rotate so that bit 0 is the current slot.
+    m = i ? (w->mask[l] >> i) | (w->mask[l] << (TWSLOTS - i)) : w->mask[l];
+    d = lowbit64(m);
+    // unless w->clk is at the very start of the current
+    // slot's span, that slot has been poured down already
+    // and what it holds now is a lap ahead.
+    if (d == 0 && l > 0 && (w->clk & (TWSPAN(l) - 1)) != 0)
+      d = (m & ~1ULL) ? lowbit64(m & ~1ULL) : TWSLOTS;
+    at = ((w->clk >> shift) + d) << shift;
+    if (at < next)
+      next = at;
+  }
+  return next;
+}
+
+// Run every timer on w due by unit now, waking the
+// processes that wait for them. w->lock must be held.
+static void
+twrun(struct wheel *w, uint64 now)
+{
+  struct timer *t, *tn;
+  uint64 next;
+  int l, i;
+
+  while (w->clk <= now)
+  {
+    // at the start of a span of level l, pour its slot
+    // down into the levels below. timers a lap ahead
+    // land back in the same slot.
+    for (l = 1; l < TWLEVELS && (w->clk & (TWSPAN(l) - 1)) == 0; l++)
+    {
+      i = (w->clk >> (TWBITS * l)) & (TWSLOTS - 1);
+      t = w->slot[l][i];
+      w->slot[l][i] = 0;
+      w->mask[l] &= ~(1ULL << i);
+      for (; t; t = tn)
+      {
+        tn = t->next;
+        twadd(w, t);
+      }
+    }
+
+    i = w->clk & (TWSLOTS - 1);
+    while ((t = w->slot[0][i]) != 0)
+    {
+      twdel(w, t);
+      wakeup(t);
+    }
+
+    w->clk++;
+    next = twnext(w);
+    if (next > w->clk)
+      w->clk = next < now + 1 ? next : now + 1;
+  }
+}
+
+// Program this hart's mtimecmp for its next tick or timer,
+// whichever comes first; an idle hart wants no ticks.
+// w must be this hart's wheel, and w->lock held.
+static void
+twarm(struct wheel *w)
+{
+  uint64 when, next;
+
+  when = w->idle ? ~0ULL : w->nexttick;
+  next = twnext(w);
+  if (next != ~0ULL && (next << TWSHIFT) < when)
+    when = next << TWSHIFT;
+  *(uint64 *)CLINT_MTIMECMP(w - wheels) = when;
+}
+
+// Called by devintr() when this hart's timer has fired.
+// Runs the timers that are due and re-arms the timer.
+// Returns 1 if a tick is due.
+int timerintr(void)
+{
+  struct wheel *w = &wheels[cpuid()];
+  uint64 now = MTIME();
+  int tick = 0;
+
+  acquire(&w->lock);
+  if (now >= w->nexttick)
+  {
+    tick = 1;
+    w->nexttick += TICKINTERVAL;
+    // missed some, e.g. while idle.
+    if (w->nexttick <= now)
+      w->nexttick = now + TICKINTERVAL;
+  }
+  twrun(w, now >> TWSHIFT);
+  twarm(w);
+  release(&w->lock);
+  return tick;
+}
+
+// Tell the timer this hart is entering or leaving
+// sched_idle(). Interrupts must be off.
+void timeridle(int idle)
+{
+  struct wheel *w = &wheels[cpuid()];
+  uint64 now = MTIME();
+
+  acquire(&w->lock);
+  w->idle = idle;
+  if (!idle && w->nexttick <= now)
+    w->nexttick = now + TICKINTERVAL;
+  twarm(w);
+  release(&w->lock);
+
+  // ticks may have stood still if every hart was idle.
+  if (!idle)
+    clockintr();
+}
+
+// Sleep for n timer cycles on the current process's timer.
+// Returns -1 if killed first.
+int timersleep(uint64 n)
+{
+  struct proc *p = myproc();
+  struct timer *t = &p->timer;
+  struct wheel *w;
+  uint64 now;
+
+  // arm the timer on this hart's wheel; holding its lock
+  // keeps us on this hart until twarm() is done.
+  push_off();
+  w = &wheels[cpuid()];
+  acquire(&w->lock);
+  pop_off();
+
+  now = MTIME();
+  twrun(w, now >> TWSHIFT);
+  t->expires = (now + n + (1 << TWSHIFT) - 1) >> TWSHIFT;
+  twadd(w, t);
+  twarm(w);
+
+  while (t->cpu >= 0)
+  {
+    if (killed(p))
+    {
+      twdel(w, t);
+      release(&w->lock);
+      return -1;
+    }
+    sleep(t, &w->lock);
+  }
+  release(&w->lock);
+  return 0;
+}
+
+// Cut p's timersleep() short, if it is in one.
+void timerwake(struct proc *p)
+{
+  struct timer *t = &p->timer;
+  struct wheel *w;
+  int cpu;
+
+  // t may move wheels until one of them is locked.
+  while ((cpu = t->cpu) >= 0)
+  {
+    w = &wheels[cpu];
+    acquire(&w->lock);
+    if (t->cpu == cpu)
+    {
+      twdel(w, t);
+      wakeup(t);
+      release(&w->lock);
+      return;
+    }
+    release(&w->lock);
+  }
+}
@@ -6,20 +6,26 @@
 #include "proc.h"
 #include "defs.h"
 
-struct spinlock tickslock;
+// whole tick intervals since boot. every hart's clock
+// interrupt may advance it, so it only changes by atomic
+// compare-and-swap; see clockintr().
 uint ticks;
+static uint64 boottime; // CLINT_MTIME at trapinit()
 
 extern char trampoline[], uservec[], userret[];
-extern struct Queue mlfq[MAXNUM];
 
 // in kernelvec.S, calls kerneltrap().
 void kernelvec();
 
 extern int devintr();
 
+// in start.c; timervec sets timer_scratch[hart][5] when
+// the timer fires.
+extern uint64 timer_scratch[NCPU][6];
+
 void trapinit(void)
 {
-  initlock(&tickslock, "time");
+  boottime = *(uint64 *)CLINT_MTIME;
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -34,7 +40,7 @@ void trapinithart(void)
 //
 void usertrap(void)
 {
-  int which_dev = 0;
+  int which_dev = 0, yielding = 0;
 
   if ((r_sstatus() & SSTATUS_SPP) != 0)
     panic("usertrap: not from user mode");
@@ -69,6 +75,20 @@ void usertrap(void)
   {
     // ok
   }
+  else if (r_scause() == 12 && vmfault(p->pagetable, r_stval(), PTE_X) == 0)
+  {
+    // instruction page fault on a page of the executable
+    // that had not been read in yet; it is now mapped.
+  }
+  else if (r_scause() == 13 && vmfault(p->pagetable, r_stval(), PTE_R) == 0)
+  {
+    // load page fault on an untouched heap or executable page.
+  }
+  else if (r_scause() == 15 && vmfault(p->pagetable, r_stval(), PTE_W) == 0)
+  {
+    // store page fault on an untouched page, or on a
+    // copy-on-write page, which now has its own copy.
+  }
   else
   {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
@@ -79,8 +99,7 @@ void usertrap(void)
   if (killed(p))
     exit(-1);
 
-    // give up the CPU if this is a timer interrupt.
-#if defined RR || defined LBS
+  // give up the CPU if this is a timer interrupt.
   if (which_dev == 2)
   {
     // alarm
@@ -96,39 +115,17 @@ void usertrap(void)
         // p->alarm_passed = 0;  // sigreturn 时再恢复: prevent re-entrant calls to the handler
       }
     }
-    yield();
-  }
-#endif
-#ifdef MLFQ
-  if (which_dev == 2 && myproc() && myproc()->state == RUNNING)
-  {
-    if (p->alarm_interval /*&& p->alarm_handler*/)
-    { // handler addr might be 0
-      if (++p->alarm_passed == p->alarm_interval)
-      {
-        memmove(&(p->etpfm), p->trapframe, sizeof(struct trapframe));
-        // return to alarm handler: call p->alarm_handler();
-        p->trapframe->epc = p->alarm_handler;
-        // printf("[DEBUG] alarm: %s(%d), handler=%x\n",
-        // 		p->name, p->pid, p->alarm_handler);
-        // p->alarm_passed = 0;  // sigreturn 时再恢复: prevent re-entrant calls to the handler
-      }
-    }
-    struct proc* p = myproc();
-    if (p->timeQuantum <= 0)
-    {
-      p->priority = p->priority +1 != MAXNUM? p->priority + 1: p->priority;
-      yield();
-    }
-    for (int i = 0; i < p->priority;i++)
-    {
-      if(mlfq[i].size)
-      {
-        yield();
-      }
-    }
+    if (sched_tick(p))
+      yielding = 1;
   }
-#endif
+
+  // or if another cpu queued something more urgent here.
+  if ((which_dev == 2 || which_dev == 3) && sched_ipi())
+    yielding = 1;
+
+  if (yielding)
+    yield();
+
   usertrapret();
 }
 
@@ -181,7 +178,7 @@ void usertrapret(void)
 // on whatever the current kernel stack is.
 void kerneltrap()
 {
-  int which_dev = 0;
+  int which_dev = 0, yielding = 0;
   uint64 sepc = r_sepc();
   uint64 sstatus = r_sstatus();
   uint64 scause = r_scause();
@@ -198,30 +195,16 @@ void kerneltrap()
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
-  if (which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
-#if defined RR || defined LBS
+  // give up the CPU if this is a timer interrupt, or an
+  // IPI from a cpu that queued something more urgent here.
+  if (which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING &&
+      sched_tick(myproc()))
+    yielding = 1;
+  if ((which_dev == 2 || which_dev == 3) && sched_ipi() &&
+      myproc() != 0 && myproc()->state == RUNNING)
+    yielding = 1;
+  if (yielding)
     yield();
-#endif
-#ifdef MLFQ
-  {
-    struct proc *p = myproc();
-    if (p->timeQuantum <= 0)
-    {
-      if(p->priority + 1 != MAXNUM){
-        p->priority++;
-      }
-      yield();
-    }
-    for (int i = 0; i < p->priority; i++)
-    {
-      if (mlfq[i].size)
-      {
-        yield();
-      }
-    }
-  }
-#endif
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -229,20 +212,37 @@ void kerneltrap()
   w_sstatus(sstatus);
 }
 
+// Bring ticks up to date with the CLINT's clock. Called at
+// each hart's ticks, and by a hart coming out of idle, since
+// idle harts skip them.
 void clockintr()
 {
-  acquire(&tickslock);
-  ticks++;
-  update_time();
-  wakeup(&ticks);
-  release(&tickslock);
+  uint now, old;
+
+  now = (*(uint64 *)CLINT_MTIME - boottime) / TICKINTERVAL;
+  while ((old = ticks) < now)
+  {
+    if (__sync_bool_compare_and_swap(&ticks, old, now))
+      break;
+  }
+}
+
+// Send an inter-processor interrupt to hart id. It arrives
+// at timervec, which passes it on to devintr().
+void sendipi(int id)
+{
+  *(uint32 *)CLINT_MSIP(id) = 1;
 }
 
 // check if it's an external interrupt or software interrupt,
 // and handle it.
-// returns 2 if timer interrupt,
+// returns 2 if timer tick,
+// 3 if some other software interrupt: an IPI from another
+//   hart, or a timer that is not a tick,
 // 1 if other device,
 // 0 if not recognized.
+// an IPI can arrive along with a tick, so callers check
+// sched_ipi() for 2 as well as 3.
 int devintr()
 {
   uint64 scause = r_scause();
@@ -278,17 +278,23 @@ int devintr()
   }
   else if (scause == 0x8000000000000001L)
   {
-    // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
-
-    if (cpuid() == 0)
-    {
-      clockintr();
-    }
+    // software interrupt from a machine-mode timer interrupt
+    // or IPI, forwarded by timervec in kernelvec.S.
+    int id = cpuid();
 
     // acknowledge the software interrupt by clearing
-    // the SSIP bit in sip.
+    // the SSIP bit in sip, then see if timervec flagged
+    // the timer. one that fires after the test sets SSIP
+    // again and comes back here.
     w_sip(r_sip() & ~2);
+    if (__sync_lock_test_and_set(&timer_scratch[id][5], 0) == 0)
+      return 3;
+
+    // the timer fires for expiring timers as well as ticks.
+    if (!timerintr())
+      return 3;
+
+    clockintr();
 
     return 2;
   }
@@ -45,9 +45,9 @@
 #define VIRTIO_RING_F_INDIRECT_DESC 28
 #define VIRTIO_RING_F_EVENT_IDX     29
 
-// this many virtio descriptors.
-// must be a power of two.
-#define NUM 8
+// this many virtio descriptors. a request takes two more
+// than the blocks it moves. must be a power of two.
+#define NUM 128
 
 // a single descriptor, from the spec.
 struct virtq_desc {
@@ -19,6 +19,9 @@
 // the address of virtio mmio register r.
 #define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
 
+// most blocks in one request.
+#define MAXSEG 32
+
 static struct disk {
   // a set (not a ring) of DMA descriptors, with which the
   // driver tells the device where to read and write individual
@@ -42,13 +45,21 @@ static struct disk {
   char free[NUM];  // is a descriptor free?
   uint16 used_idx; // we've looked this far in used[2..NUM].
 
+  int nfree;       // how many descriptors are free.
+
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf *b; // the request's bufs, linked by qnext
     char status;
   } info[NUM];
+  int inflight;    // requests the device has.
+
+  // requests not yet given to the device, sorted by
+  // block number and linked by qnext. see dispatch().
+  struct buf *queue;
+  uint head;       // block after the last one dispatched.
 
   // disk command headers.
   // one-for-one with descriptors, for convenience.
@@ -144,6 +155,7 @@ virtio_disk_init(void)
   // all NUM descriptors start out unused.
   for(int i = 0; i < NUM; i++)
     disk.free[i] = 1;
+  disk.nfree = NUM;
 
   // tell device we're completely ready.
   status |= VIRTIO_CONFIG_S_DRIVER_OK;
@@ -159,6 +171,7 @@ alloc_desc()
   for(int i = 0; i < NUM; i++){
     if(disk.free[i]){
       disk.free[i] = 0;
+      disk.nfree--;
       return i;
     }
   }
@@ -178,7 +191,7 @@ free_desc(int i)
   disk.desc[i].flags = 0;
   disk.desc[i].next = 0;
   disk.free[i] = 1;
-  wakeup(&disk.free[0]);
+  disk.nfree++;
 }
 
 // free a chain of descriptors.
@@ -196,43 +209,32 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous),
+// or none if fewer than n are free.
 static int
-alloc3_desc(int *idx)
+allocn_desc(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  if(disk.nfree < n)
+    return -1;
+  for(int i = 0; i < n; i++)
     idx[i] = alloc_desc();
-    if(idx[i] < 0){
-      for(int j = 0; j < i; j++)
-        free_desc(idx[j]);
-      return -1;
-    }
-  }
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// hand the device one request for the n bufs on the list b,
+// which are for adjacent blocks and all go the same way,
+// in descriptors idx[0..n+1]. caller holds disk.vdisk_lock.
+static void
+issue(struct buf *b, int n, int *idx)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
+  int write = b->qwrite;
 
   // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
-
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
-  }
+  // a descriptor for type/reserved/sector, then the data, then
+  // one for a 1-byte status result. the data may take as many
+  // descriptors as there are blocks.
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
   struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
@@ -242,31 +244,34 @@ virtio_disk_rw(struct buf *b, int write)
   else
     buf0->type = VIRTIO_BLK_T_IN; // read the disk
   buf0->reserved = 0;
-  buf0->sector = sector;
+  buf0->sector = b->blockno * (BSIZE / 512);
 
   disk.desc[idx[0]].addr = (uint64) buf0;
   disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  // record the bufs for virtio_disk_intr().
+  disk.info[idx[0]].b = b;
+
+  for(int i = 1; i <= n; i++, b = b->qnext){
+    disk.desc[idx[i]].addr = (uint64) b->data;
+    disk.desc[idx[i]].len = BSIZE;
+    if(write)
+      disk.desc[idx[i]].flags = 0; // device reads b->data
+    else
+      disk.desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes b->data
+    disk.desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+    disk.desc[idx[i]].next = idx[i+1];
+  }
 
   disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  disk.desc[idx[n+1]].addr = (uint64) &disk.info[idx[0]].status;
+  disk.desc[idx[n+1]].len = 1;
+  disk.desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  disk.desc[idx[n+1]].next = 0;
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  disk.inflight++;
 
   // tell the device the first index in our chain of descriptors.
   disk.avail->ring[disk.avail->idx % NUM] = idx[0];
@@ -275,25 +280,115 @@ virtio_disk_rw(struct buf *b, int write)
 
   // tell the device another avail ring entry is available.
   disk.avail->idx += 1; // not % NUM ...
+}
 
-  __sync_synchronize();
+// give the device as much of the queue as there are
+// descriptors for. requests go in one-way elevator order:
+// upward from the block after the last one dispatched, then
+// round again from the lowest. each takes the longest run of
+// adjacent blocks going the same way, up to MAXSEG.
+// caller holds disk.vdisk_lock.
+static void
+dispatch(void)
+{
+  struct buf **pp, *b, *e;
+  int n, idx[MAXSEG+2], issued = 0;
+
+  while(disk.queue){
+    for(pp = &disk.queue; *pp && (*pp)->blockno < disk.head; pp = &(*pp)->qnext)
+      ;
+    if(*pp == 0)
+      pp = &disk.queue;
+
+    b = e = *pp;
+    for(n = 1; n < MAXSEG && e->qnext; n++){
+      if(e->qnext->blockno != e->blockno + 1 || e->qnext->qwrite != b->qwrite)
+        break;
+      e = e->qnext;
+    }
+
+    if(allocn_desc(idx, n+2) < 0)
+      break;  // virtio_disk_intr() will dispatch the rest.
+    *pp = e->qnext;
+    e->qnext = 0;
+    disk.head = e->blockno + 1;
+    issue(b, n, idx);
+    issued = 1;
+  }
+
+  if(issued){
+    __sync_synchronize();
+    *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  }
+}
+
+// queue a request to read or write b, without waiting for it
+// to finish. while the device is busy, requests wait in the
+// queue, so that the ones that pile up meanwhile can be
+// merged; an idle device gets them at once.
+// caller holds disk.vdisk_lock.
+static void
+submit(struct buf *b, int write, int async)
+{
+  struct buf **pp;
+
+  b->disk = 1;
+  b->qwrite = write;
+  b->qasync = async;
+  for(pp = &disk.queue; *pp && (*pp)->blockno < b->blockno; pp = &(*pp)->qnext)
+    ;
+  b->qnext = *pp;
+  *pp = b;
+
+  if(disk.inflight == 0)
+    dispatch();
+}
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_start(b, write);
+  virtio_disk_wait(b);
+}
 
-  // Wait for virtio_disk_intr() to say request has finished.
+// start reading or writing b, which must be locked, and
+// return at once, so that a caller can have many requests
+// in flight. virtio_disk_wait(b) waits for it to finish.
+void
+virtio_disk_start(struct buf *b, int write)
+{
+  acquire(&disk.vdisk_lock);
+  submit(b, write, 0);
+  release(&disk.vdisk_lock);
+}
+
+// wait for virtio_disk_intr() to say that the request for b
+// has finished.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
   while(b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
+  release(&disk.vdisk_lock);
+}
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
-
+// start reading b, which must be locked, and return at once.
+// virtio_disk_intr() hands b to bdone() when the read is done.
+void
+virtio_disk_read_async(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
+  submit(b, 0, 1);
   release(&disk.vdisk_lock);
 }
 
 void
 virtio_disk_intr()
 {
+  struct buf *b, *bn;
+
   acquire(&disk.vdisk_lock);
 
   // the device won't raise another interrupt until we tell it
@@ -316,12 +411,25 @@ virtio_disk_intr()
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
 
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    b = disk.info[id].b;
+    disk.info[id].b = 0;
+    free_chain(id);
+    disk.inflight--;
+    for(; b; b = bn){
+      bn = b->qnext;
+      b->qnext = 0;
+      b->disk = 0;   // disk is done with buf
+      if(b->qasync)
+        bdone(b);
+      else
+        wakeup(b);
+    }
 
     disk.used_idx += 1;
   }
 
+  // the device may now be idle; give it what has queued up.
+  dispatch();
+
   release(&disk.vdisk_lock);
 }
@@ -3,6 +3,8 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
 
@@ -30,6 +32,10 @@ kvmmake(void)
   // virtio mmio disk interface
   kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
 
+  // CLINT, so that harts can interrupt each other
+  // and switch their own timers off.
+  kvmmap(kpgtbl, CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
 
@@ -104,6 +110,7 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
 
 // Look up a virtual address, return the physical address,
 // or 0 if not mapped.
+// Faults in a heap page that has not been touched yet.
 // Can only be used to look up user pages.
 uint64
 walkaddr(pagetable_t pagetable, uint64 va)
@@ -115,8 +122,11 @@ walkaddr(pagetable_t pagetable, uint64 va)
     return 0;
 
   pte = walk(pagetable, va, 0);
-  if(pte == 0)
-    return 0;
+  if(pte == 0 || (*pte & PTE_V) == 0){
+    if(vmfault(pagetable, va, PTE_R) != 0)
+      return 0;
+    pte = walk(pagetable, va, 0);
+  }
   if((*pte & PTE_V) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
@@ -165,7 +175,7 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 }
 
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that were never faulted in are skipped.
 // Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
@@ -178,9 +188,9 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
     if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
+      continue;
     if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+      continue;
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -296,10 +306,12 @@ uvmfree(pagetable_t pagetable, uint64 sz)
   freewalk(pagetable);
 }
 
-// Given a parent process's page table, copy
-// its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Given a parent process's page table, share
+// its memory with a child's page table.
+// Copies the page table but not the physical
+// memory: writable pages become read-only and
+// copy-on-write in both parent and child, and
+// uvmcow() copies them on the first store.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
@@ -308,30 +320,146 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   pte_t *pte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
   for(i = 0; i < sz; i += PGSIZE){
     if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
+      continue;  // never touched; the child faults it in itself.
     if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+      continue;
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
-    }
+    krefinc((void*)pa);
   }
+  // the parent's writable PTEs just became read-only.
+  sfence_vma();
   return 0;
 
  err:
   uvmunmap(new, 0, i / PGSIZE, 1);
+  sfence_vma();
   return -1;
 }
 
+// Give the copy-on-write page at va a private,
+// writable copy of its contents. If no other page
+// table shares the page any more, just make it
+// writable again.
+// returns 0 on success, -1 if va is not a
+// copy-on-write page or memory is exhausted.
+int
+uvmcow(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+  if((pte = walk(pagetable, va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U|PTE_COW))
+    return -1;
+
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+  if(krefcnt((void*)pa) == 1){
+    // last sharer; nobody else can take a new
+    // reference to the page, since only fork()
+    // of this address space does that.
+    *pte = PA2PTE(pa) | flags;
+  } else {
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, (char*)pa, PGSIZE);
+    *pte = PA2PTE(mem) | flags;
+    kfree((void*)pa);
+  }
+  sfence_vma();
+  return 0;
+}
+
+// Handle a user page fault at va in pagetable, which
+// must be the current process's for anything to be
+// mapped. access is PTE_R, PTE_W or PTE_X.
+// A page of the executable is read from the file; a
+// heap page that sbrk() has reserved but that has
+// never been touched gets a zeroed page; a store to
+// a copy-on-write page gets a private copy.
+// May sleep reading the executable, so must not be
+// called with a spinlock held; see uvmprefault().
+// returns 0 if va is now mapped with access allowed,
+// -1 if the access is illegal or fails.
+int
+vmfault(pagetable_t pagetable, uint64 va, int access)
+{
+  struct proc *p = myproc();
+  struct segment *s;
+  pte_t *pte;
+  char *mem;
+  int perm;
+
+  if(va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+
+  pte = walk(pagetable, va, 0);
+  if(pte && (*pte & PTE_V)){
+    if((*pte & PTE_U) == 0)
+      return -1;  // e.g. the stack guard page.
+    if(access == PTE_W && (*pte & PTE_COW))
+      return uvmcow(pagetable, va);
+    if((*pte & access) == 0)
+      return -1;
+    return 0;
+  }
+
+  if(p == 0 || pagetable != p->pagetable || va >= p->sz)
+    return -1;
+  s = segfind(p, va);
+  perm = s ? s->perm : PTE_W;
+  if(access != PTE_R && (perm & access) == 0)
+    return -1;
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(s && segload(p, s, va, mem) != 0){
+    kfree(mem);
+    return -1;
+  }
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, perm|PTE_R|PTE_U) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Fault in any pages of [va, va+len) that are not mapped
+// yet, for callers that copyin()/copyout() while holding a
+// spinlock and so cannot sleep to page in the executable.
+// Errors are left for the copy itself to report.
+void
+uvmprefault(pagetable_t pagetable, uint64 va, uint64 len, int access)
+{
+  uint64 a;
+  pte_t *pte;
+
+  if(len == 0 || va >= MAXVA || va + len < va)
+    return;
+  for(a = PGROUNDDOWN(va); a < va + len && a < MAXVA; a += PGSIZE){
+    pte = walk(pagetable, a, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0)
+      if(vmfault(pagetable, a, access) != 0)
+        return;
+  }
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void
@@ -347,17 +475,28 @@ uvmclear(pagetable_t pagetable, uint64 va)
 
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
+// Faults in untouched heap pages and breaks copy-on-write sharing
+// of the destination pages.
 // Return 0 on success, -1 on error.
 int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  pte_t *pte;
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(va0 >= MAXVA)
+      return -1;
+    pte = walk(pagetable, va0, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_COW)){
+      if(vmfault(pagetable, va0, PTE_W) != 0)
+        return -1;
+      pte = walk(pagetable, va0, 0);
+    }
+    if((*pte & PTE_U) == 0 || (*pte & PTE_W) == 0)
       return -1;
+    pa0 = PTE2PA(*pte);
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
@@ -77,8 +77,13 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
-  if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+  if(argc > 2 && strcmp(argv[1], "-l") == 0){
+    nlog = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+  if(argc < 2 || nlog < MAXOPBLOCKS+2){
+    fprintf(stderr, "Usage: mkfs [-l nlog] fs.img files...\n");
     exit(1);
   }
 
@@ -0,0 +1,103 @@
+// Buffer cache benchmark.
+//
+// bcachetest [nproc] writes a small file per process, then
+// has nproc processes (default 4) read their own files over
+// and over at the same time. The files fit in the buffer
+// cache, so the reads go no further than bget(), and with
+// one global cache lock they would run no faster than one
+// process doing them all.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NBLOCK 2      // blocks per file
+#define ROUNDS 500
+
+char buf[1024];
+
+void
+makefile(char *name)
+{
+  int fd, i;
+
+  fd = open(name, O_CREATE | O_RDWR);
+  if(fd < 0){
+    fprintf(2, "bcachetest: create %s failed\n", name);
+    exit(1);
+  }
+  memset(buf, name[1], sizeof(buf));
+  for(i = 0; i < NBLOCK; i++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      fprintf(2, "bcachetest: write %s failed\n", name);
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+void
+readfile(char *name)
+{
+  int fd, i, r;
+
+  for(r = 0; r < ROUNDS; r++){
+    fd = open(name, O_RDONLY);
+    if(fd < 0){
+      fprintf(2, "bcachetest: open %s failed\n", name);
+      exit(1);
+    }
+    for(i = 0; i < NBLOCK; i++){
+      if(read(fd, buf, sizeof(buf)) != sizeof(buf) || buf[0] != name[1]){
+        fprintf(2, "bcachetest: read %s failed\n", name);
+        exit(1);
+      }
+    }
+    close(fd);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, n, t0, t1;
+  char name[3];
+
+  n = 4;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 1 || n > 26)
+    n = 4;
+
+  name[0] = 'B';
+  name[2] = 0;
+  for(i = 0; i < n; i++){
+    name[1] = 'a' + i;
+    makefile(name);
+  }
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    name[1] = 'a' + i;
+    int pid = fork();
+    if(pid < 0){
+      fprintf(2, "bcachetest: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      readfile(name);
+      exit(0);
+    }
+  }
+  for(i = 0; i < n; i++)
+    wait(0);
+  t1 = uptime();
+
+  for(i = 0; i < n; i++){
+    name[1] = 'a' + i;
+    unlink(name);
+  }
+  printf("bcachetest: %d processes x %d rounds: %d ticks\n", n, ROUNDS, t1 - t0);
+  exit(0);
+}
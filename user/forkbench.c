@@ -0,0 +1,67 @@
+// Fork+exec latency benchmark.
+//
+// forkbench [mb] grows the heap by mb megabytes (default 8),
+// touches every page, and then times fork+exec+wait of a
+// trivial child, the way sh runs every command. Copying the
+// parent's memory in fork() makes this cost grow with mb;
+// with copy-on-write it should not.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define N 100
+
+int
+main(int argc, char *argv[])
+{
+  int i, pid, mb, t0, t1, t2;
+  char *p;
+  char *args[] = { "forkbench", "-child", 0 };
+
+  if(argc > 1 && strcmp(argv[1], "-child") == 0)
+    exit(0);
+
+  mb = 8;
+  if(argc > 1)
+    mb = atoi(argv[1]);
+
+  p = sbrk(mb * 1024 * 1024);
+  if(p == (char*)-1){
+    fprintf(2, "forkbench: sbrk failed\n");
+    exit(1);
+  }
+  for(i = 0; i < mb * 1024 * 1024; i += 4096)
+    p[i] = i;
+
+  t0 = uptime();
+  for(i = 0; i < N; i++){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "forkbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      exit(0);
+    wait(0);
+  }
+  t1 = uptime();
+  for(i = 0; i < N; i++){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "forkbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(args[0], args);
+      fprintf(2, "forkbench: exec failed\n");
+      exit(1);
+    }
+    wait(0);
+  }
+  t2 = uptime();
+
+  printf("forkbench: %d MB image, %d fork+exit in %d ticks, %d fork+exec in %d ticks\n",
+         mb, N, t1 - t0, N, t2 - t1);
+  exit(0);
+}
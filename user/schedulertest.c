@@ -2,46 +2,80 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/fcntl.h"
+#include "kernel/param.h"
+#include "kernel/sched.h"
 
 
 #define NFORK 10
 #define IO 5
 
-int main() {
-  int n, pid;
+char *policies[NSCHED] = {
+  [SCHED_RR]   "RR",
+  [SCHED_FCFS] "FCFS",
+  [SCHED_PBS]  "PBS",
+  [SCHED_LBS]  "LBS",
+  [SCHED_MLFQ] "MLFQ",
+};
+
+// run the benchmark with its processes scheduled by policy;
+// fork() gives the children this process's policy.
+void bench(int policy) {
+  int n, pid, old;
   int wtime, rtime;
   int twtime=0, trtime=0;
+
+  if ((old = setsched(policy, getpid())) < 0) {
+    printf("setsched %s failed\n", policies[policy]);
+    exit(1);
+  }
   for(n=0; n < NFORK;n++) {
       pid = fork();
       if (pid < 0)
           break;
       if (pid == 0) {
-#ifndef FCFS
-          if (n < IO) {
+          if (policy == SCHED_LBS)
+            settickets((n+1)*(n+1)); // later processes win more often
+          if (policy != SCHED_FCFS && n < IO) {
             sleep(200); // IO bound processes
           } else {
-#endif
-            for (volatile int i = 0; i < 1000000000; i++) {} // CPU bound process 
-#ifndef FCFS
+            for (volatile int i = 0; i < 1000000000; i++) {} // CPU bound process
           }
-#endif
           printf("Process %d finished\n", n);
           exit(0);
       } else {
-#ifdef PBS
-        set_priority(80, pid); // Will only matter for PBS, set lower priority for IO bound processes 
-#endif
-#ifdef LBS
-        settickets(n*n);
-#endif
+        if (policy == SCHED_PBS)
+          set_priority(80, pid); // Will only matter for PBS, set lower priority for IO bound processes
       }
   }
   for(;n > 0; n--) {
       if(waitx(0,&rtime,&wtime) >= 0) {
           trtime += rtime;
           twtime += wtime;
-      } 
+      }
+  }
+  printf("%s: Average rtime %d,  wtime %d\n", policies[policy], trtime / NFORK, twtime / NFORK);
+  setsched(old, getpid());
+}
+
+// usage: schedulertest [policy ...]
+// with no arguments, benchmarks every policy in turn.
+int main(int argc, char *argv[]) {
+  int i, policy;
+
+  if (argc < 2) {
+    for (policy = 0; policy < NSCHED; policy++)
+      bench(policy);
+  } else {
+    for (i = 1; i < argc; i++) {
+      for (policy = 0; policy < NSCHED; policy++)
+        if (strcmp(argv[i], policies[policy]) == 0)
+          break;
+      if (policy == NSCHED) {
+        printf("schedulertest: unknown policy %s\n", argv[i]);
+        continue;
+      }
+      bench(policy);
+    }
   }
-  printf("Average rtime %d,  wtime %d\n", trtime / NFORK, twtime / NFORK);
   exit(0);
-}
\ No newline at end of file
+}
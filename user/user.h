@@ -31,6 +31,8 @@ int sigreturn(void);
 int waitx(int *, int *, int *);
 int set_priority(int priority, int pid);
 int settickets(int);
+int setsched(int policy, int pid);
+int nsleep(uint64 ns);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -815,6 +815,42 @@ killstatus(char *s)
   exit(0);
 }
 
+// nsleep() sleeps at least as long as asked,
+// and kill() cuts it short.
+void
+nsleeptest(char *s)
+{
+  int t0, pid, xst;
+
+  t0 = uptime();
+  if(nsleep(300000000) < 0){
+    printf("%s: nsleep failed\n", s);
+    exit(1);
+  }
+  if(uptime() - t0 < 2){
+    printf("%s: nsleep woke early\n", s);
+    exit(1);
+  }
+
+  t0 = uptime();
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    nsleep(100000000000ULL);
+    exit(0);
+  }
+  sleep(1);
+  kill(pid);
+  wait(&xst);
+  if(xst != -1 || uptime() - t0 > 50){
+    printf("%s: kill did not end nsleep\n", s);
+    exit(1);
+  }
+}
+
 // meant to be run w/ at most two CPUs
 void
 preempt(char *s)
@@ -1086,6 +1122,50 @@ mem(char *s)
   }
 }
 
+// fork a process whose memory is larger than half of RAM.
+// only succeeds if fork() shares pages copy-on-write.
+// then check that parent and child see their own stores.
+void
+cowfork(char *s)
+{
+  uint64 sz = (PHYSTOP - KERNBASE) / 3 * 2;
+  char *p, *q;
+  int pid, xstatus, me = getpid();
+
+  p = sbrk(sz);
+  if(p == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk(%d) failed\n", s, sz);
+    exit(1);
+  }
+  for(q = p; q < p + sz; q += 4096)
+    *(int*)q = me;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(q = p; q < p + sz; q += 4096*64)
+      *(int*)q = -1;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  for(q = p; q < p + sz; q += 4096){
+    if(*(int*)q != me){
+      printf("%s: parent saw child's store at %p\n", s, q);
+      exit(1);
+    }
+  }
+  if(sbrk(-sz) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk(-%d) failed\n", s, sz);
+    exit(1);
+  }
+  exit(0);
+}
+
 // More file system tests
 
 // two processes write to the same file descriptor
@@ -2117,6 +2197,34 @@ sbrkmuch(char *s)
   }
 }
 
+// sbrk() only reserves address space; pages are allocated on
+// first touch. grow by more than physical memory, touch a few
+// pages, and give it back.
+void
+sbrklazy(char *s)
+{
+  enum { BIG=1024*1024*1024 };
+  char *a, *p;
+
+  a = sbrk(BIG);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: lazy sbrk(%d) failed\n", s, BIG);
+    exit(1);
+  }
+  for(p = a; p < a + BIG; p += BIG/8){
+    if(*p != 0){
+      printf("%s: untouched heap page not zero\n", s);
+      exit(1);
+    }
+    *p = 1;
+  }
+  a[BIG-1] = 1;
+  if(sbrk(-BIG) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk(-%d) failed\n", s, BIG);
+    exit(1);
+  }
+}
+
 // can we read the kernel's memory?
 void
 kernmem(char *s)
@@ -2595,6 +2703,7 @@ struct test {
   {exectest, "exectest"},
   {pipe1, "pipe1"},
   {killstatus, "killstatus"},
+  {nsleeptest, "nsleep"},
   {preempt, "preempt"},
   {exitwait, "exitwait"},
   {reparent, "reparent" },
@@ -2603,6 +2712,7 @@ struct test {
   {forkforkfork, "forkforkfork"},
   {reparent2, "reparent2"},
   {mem, "mem"},
+  {cowfork, "cowfork"},
   {sharedfd, "sharedfd"},
   {fourfiles, "fourfiles"},
   {createdelete, "createdelete"},
@@ -2620,6 +2730,7 @@ struct test {
   {forktest, "forktest"},
   {sbrkbasic, "sbrkbasic"},
   {sbrkmuch, "sbrkmuch"},
+  {sbrklazy, "sbrklazy"},
   {kernmem, "kernmem"},
   {MAXVAplus, "MAXVAplus"},
   {sbrkfail, "sbrkfail"},
@@ -44,3 +44,5 @@ entry("sigreturn");
 entry("waitx");
 entry("set_priority");
 entry("settickets");
+entry("setsched");
+entry("nsleep");